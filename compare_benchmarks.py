@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+"""Compares two result files of the nms_benchmark target.
+
+Usage: ./compare_benchmarks.py BASELINE.json CONTENDER.json
+
+The result files are written by
+    bazel run -c opt //lanms:nms_benchmark -- --benchmark_out=FILE --benchmark_out_format=json
+or by ./run.sh benchmark FILE. For each benchmark the time per iteration and the number of heap
+allocations per iteration of both builds are printed along with the relative change of the time.
+"""
+import json
+import sys
+
+
+def _load(path):
+    with open(path) as f:
+        results = json.load(f)["benchmarks"]
+    # Only compare plain runs, not aggregates such as means of repetitions.
+    return {b["name"]: b for b in results if b.get("run_type", "iteration") == "iteration"}
+
+
+def _time_ns(benchmark):
+    scale = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}[benchmark.get("time_unit", "ns")]
+    return benchmark["real_time"] * scale
+
+
+def main(argv):
+    if len(argv) != 3:
+        print(__doc__)
+        return 1
+
+    baseline = _load(argv[1])
+    contender = _load(argv[2])
+
+    name_width = max([len(name) for name in baseline] + [len("Benchmark")])
+    print("{:<{w}} {:>14} {:>14} {:>9} {:>10} {:>10}".format(
+        "Benchmark", "Baseline [ns]", "Contender [ns]", "Change", "Allocs", "Allocs", w=name_width))
+    for name, b in baseline.items():
+        if name not in contender:
+            continue
+        c = contender[name]
+        baseline_time = _time_ns(b)
+        contender_time = _time_ns(c)
+        change = (contender_time - baseline_time) / baseline_time if baseline_time else 0.0
+        print("{:<{w}} {:>14.1f} {:>14.1f} {:>+8.1%} {:>10.1f} {:>10.1f}".format(
+            name, baseline_time, contender_time, change, b.get("allocs", float("nan")),
+            c.get("allocs", float("nan")), w=name_width))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
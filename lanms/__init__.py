@@ -1 +1,9 @@
-from .python.ops.nms_ops import locality_aware_nms
\ No newline at end of file
+from .python.ops.nms_ops import batched_locality_aware_nms
+from .python.ops.nms_ops import batched_standard_nms
+from .python.ops.nms_ops import class_aware_locality_aware_nms
+from .python.ops.nms_ops import class_aware_standard_nms
+from .python.ops.nms_ops import geometry_map_locality_aware_nms
+from .python.ops.nms_ops import locality_aware_nms
+from .python.ops.nms_ops import soft_nms
+from .python.ops.nms_ops import standard_nms
+from .python.ops.nms_ops import tiled_locality_aware_nms
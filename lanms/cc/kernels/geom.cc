@@ -1,6 +1,6 @@
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
-#include <vector>
 
 #include "geom.h"
 
@@ -10,44 +10,169 @@ namespace geom {
 /*
 Note:
 In these functions we assume that
-- polygons are ordered in clockwise order.
-- polygons don't have more than two collinear vertices.
-- polygons have at least three vertices.
 - polygons are convex.
+- the intersection of two polygons has at most kMaxPolygonVertices vertices
+  (always true for two quadrilaterals).
+
+polygon_intersection assumes clockwise polygons (in image coordinates, i.e. with the y axis pointing
+down), the other functions bring their inputs into clockwise order first, see clockwise. Collinear
+and repeated vertices and polygons without area are allowed, they never produce NaNs: edges of zero
+length don't clip and polygons without area don't overlap anything.
 */
 
+AxisAlignedBox
+axis_aligned_box(const Quad &quad) {
+  // Return the smallest axis aligned box containing the quadrilateral.
+  AxisAlignedBox box{quad[0].x, quad[0].y, quad[0].x, quad[0].y};
+  for (std::size_t i = 1; i < 4; i++) {
+    box.min_x = std::min(box.min_x, quad[i].x);
+    box.min_y = std::min(box.min_y, quad[i].y);
+    box.max_x = std::max(box.max_x, quad[i].x);
+    box.max_y = std::max(box.max_y, quad[i].y);
+  }
+  return box;
+}
+
+bool
+is_axis_aligned(const Quad &quad) {
+  // Return whether the quadrilateral is a rectangle with edges parallel to the axes, in which case
+  // its intersection with other such rectangles is its intersection with their axis aligned boxes.
+  bool horizontal_first = quad[0].y == quad[1].y && quad[1].x == quad[2].x &&
+                          quad[2].y == quad[3].y && quad[3].x == quad[0].x;
+  bool vertical_first = quad[0].x == quad[1].x && quad[1].y == quad[2].y &&
+                        quad[2].x == quad[3].x && quad[3].y == quad[0].y;
+  return horizontal_first || vertical_first;
+}
+
+bool
+disjoint(const AxisAlignedBox &a, const AxisAlignedBox &b) {
+  // Return whether the boxes are separated along either axis.
+  return b.min_x > a.max_x || b.max_x < a.min_x || b.min_y > a.max_y || b.max_y < a.min_y;
+}
+
 float
-polygon_area(const Polygon &polygon) {
-  // Return the area of the polygon.
+intersection_area(const AxisAlignedBox &a, const AxisAlignedBox &b) {
+  // Return the area of the intersection of the boxes.
+  if (disjoint(a, b)) {
+    return 0.0;
+  }
+  auto w = std::min(a.max_x, b.max_x) - std::max(a.min_x, b.min_x);
+  auto h = std::min(a.max_y, b.max_y) - std::max(a.min_y, b.min_y);
+  return w * h;
+}
+
+static float
+_signed_area(const Point *vertices, std::size_t n) {
+  // Positive for clockwise polygons.
   float area = 0.0;
+  for (std::size_t i = 0; i < n; i++) {
+    auto j = (i + 1) % n;
+    area += vertices[i].x * vertices[j].y - vertices[j].x * vertices[i].y;
+  }
+  return area / 2.0;
+}
+
+static float
+_polygon_area(const Point *vertices, std::size_t n) {
+  return std::fabs(_signed_area(vertices, n));
+}
+
+static Polygon
+_clockwise(const Polygon &polygon) {
+  if (!(_signed_area(polygon.begin(), polygon.size()) < 0.0)) {
+    return polygon;
+  }
+  Polygon reversed;
   for (std::size_t i = 0; i < polygon.size(); i++) {
-    auto j = (i + 1) % polygon.size();
-    area += polygon[i].x * polygon[j].y - polygon[j].x * polygon[i].y;
+    reversed.push_back(polygon[(polygon.size() - i) % polygon.size()]);
+  }
+  return reversed;
+}
+
+Quad
+clockwise(const Quad &quad) {
+  // Return the quadrilateral with its vertices in clockwise order, counter-clockwise vertices are
+  // reversed starting from the first vertex.
+  if (!(_signed_area(quad.begin(), 4) < 0.0)) {
+    return quad;
   }
-  area = area / 2.0;
-  area = std::fabs(area);
-  return area;
+  return Quad{quad[0], quad[3], quad[2], quad[1]};
+}
+
+float
+polygon_area(const Polygon &polygon) {
+  // Return the area of the polygon.
+  return _polygon_area(polygon.begin(), polygon.size());
+}
+
+float
+polygon_area(const Quad &quad) {
+  // Return the area of the quadrilateral.
+  return _polygon_area(quad.begin(), 4);
+}
+
+static inline float
+_side(const Point &p, const Point &v1, const Point &edge) {
+  // Positive if p is inside of (right of) the edge starting at v1.
+  return edge.x * (p.y - v1.y) - edge.y * (p.x - v1.x);
+}
+
+static inline Point
+_interpolate(const Point &p1, const Point &p2, float s1, float s2) {
+  // The point on the line p1 -> p2 at which the side changes from s1 to s2, s1 != s2.
+  float t = s1 / (s1 - s2);
+  return Point{p1.x + t * (p2.x - p1.x), p1.y + t * (p2.y - p1.y)};
 }
 
 Point
 compute_intersection(const Point &p1, const Point &p2, const Point &v1, const Point &v2) {
-  // Computes the intersection point of the line segment p1 -> p2 and the infinite edge v1 -> v2.
-  using Vec2 = Point;
-  auto dc = Vec2({v1.x - v2.x, v1.y - v2.y});
-  auto dp = Vec2({p2.x - p1.x, p2.y - p1.y});
-  float n1 = v1.x * v2.y - v1.y * v2.x;
-  float n2 = p2.x * p1.y - p2.y * p1.x;
-  float n3 = 1.0 / (dc.x * dp.y - dc.y * dp.x);
-  return Point({
-    (n1 * dp.x - n2 * dc.x) * n3,
-    (n1 * dp.y - n2 * dc.y) * n3
-  });
+  // Computes the intersection point of the line through p1 and p2 and the infinite edge v1 -> v2.
+  // The lines don't intersect if they are parallel, p1 is returned in that case.
+  Point edge{v2.x - v1.x, v2.y - v1.y};
+  float s1 = _side(p1, v1, edge);
+  float s2 = _side(p2, v1, edge);
+  return s1 == s2 ? p1 : _interpolate(p1, p2, s1, s2);
 }
 
 bool
 inside_edge(const Point &p, const Point &v1, const Point &v2) {
   // Return whether the point p is inside of (right of) the edge v1 -> v2.
-  return (v2.x - v1.x) * (p.y - v1.y) > (v2.y - v1.y) * (p.x - v1.x);
+  return _side(p, v1, Point{v2.x - v1.x, v2.y - v1.y}) > 0;
+}
+
+static void
+_clip(const Polygon &subject_polygon, const Point &v1, const Point &v2, Polygon &clipped_polygon) {
+  // Clips the polygon to the inside of the edge v1 -> v2, see inside_edge. Intersections are
+  // interpolated between vertices on different sides of the edge, which can't divide by zero.
+  clipped_polygon.clear();
+  auto n = subject_polygon.size();
+  if (n == 0) {
+    return;
+  }
+
+  Point edge{v2.x - v1.x, v2.y - v1.y};
+  if (edge.x == 0 && edge.y == 0) {
+    // Repeated vertices don't bound the polygon.
+    clipped_polygon = subject_polygon;
+    return;
+  }
+
+  Point prev_point = subject_polygon[n - 1];
+  float prev_side = _side(prev_point, v1, edge);
+  for (std::size_t k = 0; k < n; k++) {
+    Point current_point = subject_polygon[k];
+    float current_side = _side(current_point, v1, edge);
+    if (current_side > 0) {
+      if (!(prev_side > 0)) {
+        clipped_polygon.push_back(_interpolate(prev_point, current_point, prev_side, current_side));
+      }
+      clipped_polygon.push_back(current_point);
+    } else if (prev_side > 0) {
+      clipped_polygon.push_back(_interpolate(prev_point, current_point, prev_side, current_side));
+    }
+    prev_point = current_point;
+    prev_side = current_side;
+  }
 }
 
 Polygon
@@ -55,46 +180,47 @@ polygon_intersection(const Polygon &subject_polygon, const Polygon &clip_polygon
   // Implements the Sutherland-Hodgman algorithm for polygon clipping.
   // See https://en.wikipedia.org/wiki/Sutherland%E2%80%93Hodgman_algorithm
 
-  // Initial polygon.
-  Polygon intersection_polygon = subject_polygon;
+  // Initial polygon. Both buffers live on the stack and are swapped between clip edges.
+  Polygon buffers[2] = {subject_polygon, Polygon()};
+  std::size_t current = 0;
 
   // Iterate over clip edges.
   for (std::size_t i = 0; i < clip_polygon.size(); i++) {
-    Polygon current_polygon = intersection_polygon;
-    intersection_polygon.clear();
-
     auto j = (i + 1) % clip_polygon.size();
-    Point v1 = clip_polygon[i];
-    Point v2 = clip_polygon[j];
-
-    // Iterate over the points in the current polygon.
-    for (std::size_t k = 0; k < current_polygon.size(); k++) {
-      Point current_point = current_polygon[k];
-      Point prev_point = current_polygon[(k + current_polygon.size() - 1) % current_polygon.size()];
-
-      Point intersecting_point = compute_intersection(prev_point, current_point, v1, v2);
-
-      if (inside_edge(current_point, v1, v2)) {
-        if (!inside_edge(prev_point, v1, v2)) {
-          intersection_polygon.push_back(intersecting_point);
-        }
-        intersection_polygon.push_back(current_point);
-      } else if (inside_edge(prev_point, v1, v2)) {
-        intersection_polygon.push_back(intersecting_point);
-      }
-    }
+    _clip(buffers[current], clip_polygon[i], clip_polygon[j], buffers[1 - current]);
+    current = 1 - current;
   }
 
-  return intersection_polygon;
+  return buffers[current];
+}
+
+static inline float
+_intersection_over_union(float intersection_area, float union_area) {
+  // Polygons without area, or with non-finite vertices, don't overlap anything.
+  return union_area > 0 ? std::min(intersection_area / union_area, 1.0f) : 0.0f;
 }
 
 float
 intersection_over_union(const Polygon &a, const Polygon &b) {
   // Return the ratio of the areas of the intersection and union of polygons a and b.
-  auto intersection_area = polygon_area(polygon_intersection(a, b));
+  auto intersection_area = polygon_area(polygon_intersection(_clockwise(a), _clockwise(b)));
   auto union_area = polygon_area(a) + polygon_area(b) - intersection_area;
-  auto iou = intersection_area / union_area;
-  return iou;
+  return _intersection_over_union(intersection_area, union_area);
+}
+
+float
+intersection_over_union(const Quad &a, const Quad &b) {
+  // Return the ratio of the areas of the intersection and union of quadrilaterals a and b.
+  return intersection_over_union(clockwise(a), clockwise(b), polygon_area(a), polygon_area(b));
+}
+
+float
+intersection_over_union(const Quad &a, const Quad &b, float a_area, float b_area) {
+  // Same as above with the areas of a and b given, e.g. if they are reused for many tests. Both
+  // quadrilaterals must be clockwise already.
+  auto intersection_area = polygon_area(polygon_intersection(a, b));
+  auto union_area = a_area + b_area - intersection_area;
+  return _intersection_over_union(intersection_area, union_area);
 }
 
 }
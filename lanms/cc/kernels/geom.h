@@ -1,6 +1,8 @@
 #ifndef GEOM_H_
 #define GEOM_H_
 
+#include <cstddef>
+#include <initializer_list>
 #include <vector>
 
 
@@ -11,11 +13,130 @@ struct Point {
   float y;
 };
 
-typedef std::vector<Point> Polygon;
+// The intersection of two convex quadrilaterals has at most eight vertices.
+const std::size_t kMaxPolygonVertices = 8;
+
+struct Quad {
+  // A fixed size quadrilateral stored inline, i.e. without any heap allocation.
+  Quad() {}
+
+  Quad(std::initializer_list<Point> points) {
+    std::size_t i = 0;
+    for (auto it = points.begin(); it != points.end() && i < 4; ++it) {
+      vertices[i++] = *it;
+    }
+  }
+
+  std::size_t size() const { return 4; }
+  Point &operator[](std::size_t i) { return vertices[i]; }
+  const Point &operator[](std::size_t i) const { return vertices[i]; }
+  const Point *begin() const { return vertices; }
+  const Point *end() const { return vertices + 4; }
+
+  Point vertices[4];
+};
+
+class Polygon {
+  // A convex polygon with a bounded number of vertices stored inline, i.e. without any heap allocation.
+ public:
+  Polygon() : size_(0) {}
+
+  Polygon(std::initializer_list<Point> points) : size_(0) {
+    for (auto &&p : points) {
+      push_back(p);
+    }
+  }
+
+  Polygon(const Quad &quad) : size_(4) {
+    for (std::size_t i = 0; i < 4; i++) {
+      vertices_[i] = quad[i];
+    }
+  }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  void clear() { size_ = 0; }
+  void push_back(const Point &p) { if (size_ < kMaxPolygonVertices) vertices_[size_++] = p; }
+  Point &operator[](std::size_t i) { return vertices_[i]; }
+  const Point &operator[](std::size_t i) const { return vertices_[i]; }
+  const Point *begin() const { return vertices_; }
+  const Point *end() const { return vertices_ + size_; }
+
+ private:
+  Point vertices_[kMaxPolygonVertices];
+  std::size_t size_;
+};
+
+struct AxisAlignedBox {
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+};
+
+class QuadBatch {
+  // A batch of quadrilaterals in structure-of-arrays layout, i.e. x(k)[i] is the x coordinate
+  // of vertex k of quadrilateral i. The area of each quadrilateral is precomputed on insertion.
+  // Quadrilaterals are brought into clockwise order on insertion unless their area is given.
+ public:
+  void reserve(std::size_t n);
+  void push_back(const Quad &quad);
+  void push_back(const Quad &quad, float area, const AxisAlignedBox &aabb);
+  void push_back(const QuadBatch &other, std::size_t i);
+  void move(std::size_t from, std::size_t to);
+  void resize(std::size_t n);
+  std::size_t size() const { return area_.size(); }
+  Quad quad(std::size_t i) const;
+  AxisAlignedBox aabb(std::size_t i) const { return AxisAlignedBox{min_x_[i], min_y_[i], max_x_[i], max_y_[i]}; }
+
+  const float *x(std::size_t k) const { return x_[k].data(); }
+  const float *y(std::size_t k) const { return y_[k].data(); }
+  const float *area() const { return area_.data(); }
+  const float *min_x() const { return min_x_.data(); }
+  const float *min_y() const { return min_y_.data(); }
+  const float *max_x() const { return max_x_.data(); }
+  const float *max_y() const { return max_y_.data(); }
+
+ private:
+  std::vector<float> x_[4];
+  std::vector<float> y_[4];
+  std::vector<float> area_;
+  std::vector<float> min_x_;
+  std::vector<float> min_y_;
+  std::vector<float> max_x_;
+  std::vector<float> max_y_;
+};
+
+enum SimdLevel {
+  kSimdScalar = 0,
+  kSimdSSE = 1,
+  kSimdAVX2 = 2,
+};
+
+SimdLevel
+supported_simd_level();
+
+Quad
+clockwise(const Quad &quad);
+
+AxisAlignedBox
+axis_aligned_box(const Quad &quad);
+
+bool
+is_axis_aligned(const Quad &quad);
+
+bool
+disjoint(const AxisAlignedBox &a, const AxisAlignedBox &b);
+
+float
+intersection_area(const AxisAlignedBox &a, const AxisAlignedBox &b);
 
 float
 polygon_area(const Polygon &polygon);
 
+float
+polygon_area(const Quad &quad);
+
 Point
 compute_intersection(const Point &p1, const Point &p2, const Point &v1, const Point &v2);
 
@@ -28,6 +149,19 @@ polygon_intersection(const Polygon &subject_polygon, const Polygon &clip_polygon
 float
 intersection_over_union(const Polygon &a, const Polygon &b);
 
+float
+intersection_over_union(const Quad &a, const Quad &b);
+
+float
+intersection_over_union(const Quad &a, const Quad &b, float a_area, float b_area);
+
+std::size_t
+intersection_over_union(const Quad &a, const QuadBatch &b, std::size_t begin, std::size_t end, float *out,
+                        SimdLevel level = supported_simd_level());
+
+void
+intersection_over_union(const Quad &a, const Quad *b, std::size_t n, float *out);
+
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#include "geom.h"
+#include "geom_batch.h"
+
+
+namespace geom {
+
+namespace {
+
+struct ScalarOps {
+  typedef float V;
+  typedef bool M;
+  static const std::size_t kWidth = 1;
+
+  static V zero() { return 0.0f; }
+  static V set1(float x) { return x; }
+  static V load(const float *p) { return *p; }
+  static void store(float *p, V v) { *p = v; }
+  static V add(V a, V b) { return a + b; }
+  static V sub(V a, V b) { return a - b; }
+  static V mul(V a, V b) { return a * b; }
+  static V div(V a, V b) { return a / b; }
+  static V min(V a, V b) { return a < b ? a : b; }
+  static V max(V a, V b) { return a > b ? a : b; }
+  static V abs(V a) { return std::fabs(a); }
+  static M lt(V a, V b) { return a < b; }
+  static M eq(V a, V b) { return a == b; }
+  static M and_(M a, M b) { return a && b; }
+  static M or_(M a, M b) { return a || b; }
+  static M andnot(M a, M b) { return !a && b; }
+  static V select(M m, V a, V b) { return m ? a : b; }
+  static bool all(M m) { return m; }
+};
+
+#if defined(__x86_64__)
+struct SseOps {
+  typedef __m128 V;
+  typedef __m128 M;
+  static const std::size_t kWidth = 4;
+
+  static V zero() { return _mm_setzero_ps(); }
+  static V set1(float x) { return _mm_set1_ps(x); }
+  static V load(const float *p) { return _mm_loadu_ps(p); }
+  static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+  static V add(V a, V b) { return _mm_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm_div_ps(a, b); }
+  static V min(V a, V b) { return _mm_min_ps(a, b); }
+  static V max(V a, V b) { return _mm_max_ps(a, b); }
+  static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+  static M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+  static M eq(V a, V b) { return _mm_cmpeq_ps(a, b); }
+  static M and_(M a, M b) { return _mm_and_ps(a, b); }
+  static M or_(M a, M b) { return _mm_or_ps(a, b); }
+  static M andnot(M a, M b) { return _mm_andnot_ps(a, b); }
+  static V select(M m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+  static bool all(M m) { return _mm_movemask_ps(m) == 0xf; }
+};
+#endif
+
+batch::Anchor
+_make_anchor(const Quad &quad) {
+  auto a = clockwise(quad);
+  batch::Anchor anchor;
+  anchor.origin_x = a[0].x;
+  anchor.origin_y = a[0].y;
+  for (std::size_t k = 0; k < 4; k++) {
+    anchor.x[k] = a[k].x - anchor.origin_x;
+    anchor.y[k] = a[k].y - anchor.origin_y;
+  }
+  for (std::size_t k = 0; k < 4; k++) {
+    anchor.edge_x[k] = anchor.x[(k + 1) % 4] - anchor.x[k];
+    anchor.edge_y[k] = anchor.y[(k + 1) % 4] - anchor.y[k];
+  }
+  anchor.area = polygon_area(a);
+  auto aabb = axis_aligned_box(a);
+  anchor.min_x = aabb.min_x;
+  anchor.min_y = aabb.min_y;
+  anchor.max_x = aabb.max_x;
+  anchor.max_y = aabb.max_y;
+  anchor.axis_aligned = is_axis_aligned(a);
+  return anchor;
+}
+
+}
+
+namespace batch {
+
+std::size_t
+intersection_over_union_sse(const Anchor &a, const Candidates &b, std::size_t n, float *out) {
+#if defined(__x86_64__)
+  return intersection_over_union<SseOps>(a, b, n, out);
+#else
+  return intersection_over_union<ScalarOps>(a, b, n, out);
+#endif
+}
+
+}
+
+void
+QuadBatch::reserve(std::size_t n) {
+  for (std::size_t k = 0; k < 4; k++) {
+    x_[k].reserve(n);
+    y_[k].reserve(n);
+  }
+  area_.reserve(n);
+  min_x_.reserve(n);
+  min_y_.reserve(n);
+  max_x_.reserve(n);
+  max_y_.reserve(n);
+}
+
+void
+QuadBatch::push_back(const Quad &quad) {
+  push_back(clockwise(quad), polygon_area(quad), axis_aligned_box(quad));
+}
+
+void
+QuadBatch::push_back(const Quad &quad, float area, const AxisAlignedBox &aabb) {
+  for (std::size_t k = 0; k < 4; k++) {
+    x_[k].push_back(quad[k].x);
+    y_[k].push_back(quad[k].y);
+  }
+  area_.push_back(area);
+  min_x_.push_back(aabb.min_x);
+  min_y_.push_back(aabb.min_y);
+  max_x_.push_back(aabb.max_x);
+  max_y_.push_back(aabb.max_y);
+}
+
+void
+QuadBatch::push_back(const QuadBatch &other, std::size_t i) {
+  push_back(other.quad(i), other.area_[i], other.aabb(i));
+}
+
+Quad
+QuadBatch::quad(std::size_t i) const {
+  Quad quad;
+  for (std::size_t k = 0; k < 4; k++) {
+    quad[k] = Point{x_[k][i], y_[k][i]};
+  }
+  return quad;
+}
+
+void
+QuadBatch::move(std::size_t from, std::size_t to) {
+  for (std::size_t k = 0; k < 4; k++) {
+    x_[k][to] = x_[k][from];
+    y_[k][to] = y_[k][from];
+  }
+  area_[to] = area_[from];
+  min_x_[to] = min_x_[from];
+  min_y_[to] = min_y_[from];
+  max_x_[to] = max_x_[from];
+  max_y_[to] = max_y_[from];
+}
+
+void
+QuadBatch::resize(std::size_t n) {
+  for (std::size_t k = 0; k < 4; k++) {
+    x_[k].resize(n);
+    y_[k].resize(n);
+  }
+  area_.resize(n);
+  min_x_.resize(n);
+  min_y_.resize(n);
+  max_x_.resize(n);
+  max_y_.resize(n);
+}
+
+SimdLevel
+supported_simd_level() {
+  // Return the widest instruction set supported by both this build and the current cpu. The avx2
+  // kernels are only part of the build if LANMS_HAVE_AVX2 is defined.
+#if defined(LANMS_HAVE_AVX2) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  static const SimdLevel level = __builtin_cpu_supports("avx2") ? kSimdAVX2 : kSimdSSE;
+  return level;
+#elif defined(__x86_64__)
+  return kSimdSSE;
+#else
+  return kSimdScalar;
+#endif
+}
+
+std::size_t
+intersection_over_union(const Quad &a, const QuadBatch &b, std::size_t begin, std::size_t end, float *out,
+                        SimdLevel level) {
+  // Computes the intersection over union of a and each of the quadrilaterals b[begin:end] into
+  // out[0:end - begin]. Returns the number of quadrilaterals whose intersection over union was
+  // known to be zero from their axis aligned boxes alone.
+  auto anchor = _make_anchor(a);
+  batch::Candidates candidates;
+  for (std::size_t k = 0; k < 4; k++) {
+    candidates.x[k] = b.x(k) + begin;
+    candidates.y[k] = b.y(k) + begin;
+  }
+  candidates.area = b.area() + begin;
+  candidates.min_x = b.min_x() + begin;
+  candidates.min_y = b.min_y() + begin;
+  candidates.max_x = b.max_x() + begin;
+  candidates.max_y = b.max_y() + begin;
+  auto n = end - begin;
+
+  switch (std::min(level, supported_simd_level())) {
+#if defined(LANMS_HAVE_AVX2)
+    case kSimdAVX2:
+      return batch::intersection_over_union_avx2(anchor, candidates, n, out);
+#endif
+    case kSimdSSE:
+      return batch::intersection_over_union_sse(anchor, candidates, n, out);
+    default:
+      return batch::intersection_over_union<ScalarOps>(anchor, candidates, n, out);
+  }
+}
+
+void
+intersection_over_union(const Quad &a, const Quad *b, std::size_t n, float *out) {
+  // Computes the intersection over union of a and each of the n quadrilaterals in b.
+  QuadBatch batch;
+  batch.reserve(n);
+  for (std::size_t i = 0; i < n; i++) {
+    batch.push_back(b[i]);
+  }
+  intersection_over_union(a, batch, 0, n, out);
+}
+
+}
@@ -0,0 +1,279 @@
+#ifndef GEOM_BATCH_H_
+#define GEOM_BATCH_H_
+
+#include <cstddef>
+
+
+namespace geom {
+namespace batch {
+
+/*
+Batched one-vs-many intersection over union of quadrilaterals.
+
+The kernel is written once against a small vector "Ops" interface and instantiated for scalar,
+SSE and AVX2 registers. Since every instantiation performs the exact same sequence of IEEE
+operations the results are identical regardless of which instruction set is used.
+
+Instead of Sutherland-Hodgman clipping, which produces a different number of vertices per
+candidate, the intersection area is computed from its boundary (Green's theorem): the boundary
+of a ∩ b consists of the parts of the edges of a that lie inside b and the parts of the edges of
+b that lie inside a. Each edge is clipped to the other quadrilateral with the Cyrus-Beck
+algorithm, which is branch free and thus maps directly onto SIMD lanes.
+
+Blocks in which no candidate's axis aligned box overlaps that of the anchor are skipped entirely
+since their intersection over union is zero. If the anchor and all candidates of a block are axis
+aligned rectangles, the intersection over union is computed from the axis aligned boxes instead.
+
+Edges that are collinear with an edge of the other quadrilateral are counted once if they point
+in the same direction and cancel out otherwise. Edges of zero length never clip, quadrilaterals are
+expected in clockwise order, see geom::clockwise.
+
+Note: This header is included by translation units compiled with different instruction sets and
+must therefore only contain templates that are instantiated with translation unit local types.
+*/
+
+struct Anchor {
+  // Coordinates of the anchor quadrilateral, relative to its first vertex, and its edge vectors.
+  // The anchor is prepared once and reused for all blocks of candidates.
+  float x[4];
+  float y[4];
+  float edge_x[4];
+  float edge_y[4];
+  float origin_x;
+  float origin_y;
+  float area;
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+  bool axis_aligned;
+};
+
+struct Candidates {
+  const float *x[4];
+  const float *y[4];
+  const float *area;
+  const float *min_x;
+  const float *min_y;
+  const float *max_x;
+  const float *max_y;
+};
+
+template <typename Ops>
+inline typename Ops::V
+clipped_edge_cross(typename Ops::V px, typename Ops::V py, typename Ops::V qx, typename Ops::V qy,
+                   const typename Ops::V *vx, const typename Ops::V *vy,
+                   const typename Ops::V *ex, const typename Ops::V *ey, bool reject_collinear) {
+  // Clips the segment p -> q to the convex quadrilateral given by vertices v and edges e and
+  // returns the cross product of the end points of the clipped segment (zero if empty).
+  typedef typename Ops::V V;
+  typedef typename Ops::M M;
+
+  V dx = Ops::sub(qx, px);
+  V dy = Ops::sub(qy, py);
+  V zero = Ops::zero();
+  V t0 = zero;
+  V t1 = Ops::set1(1.0f);
+  M rejected = Ops::lt(t1, zero);
+
+  for (std::size_t k = 0; k < 4; k++) {
+    V sp = Ops::sub(Ops::mul(ex[k], Ops::sub(py, vy[k])), Ops::mul(ey[k], Ops::sub(px, vx[k])));
+    V sq = Ops::sub(Ops::mul(ex[k], Ops::sub(qy, vy[k])), Ops::mul(ey[k], Ops::sub(qx, vx[k])));
+    M p_outside = Ops::lt(sp, zero);
+    M q_outside = Ops::lt(sq, zero);
+    V t = Ops::div(sp, Ops::sub(sp, sq));
+    t0 = Ops::select(Ops::andnot(q_outside, p_outside), Ops::max(t0, t), t0);
+    t1 = Ops::select(Ops::andnot(p_outside, q_outside), Ops::min(t1, t), t1);
+    rejected = Ops::or_(rejected, Ops::and_(p_outside, q_outside));
+
+    if (reject_collinear) {
+      M collinear = Ops::and_(Ops::eq(sp, zero), Ops::eq(sq, zero));
+      M same_direction = Ops::lt(zero, Ops::add(Ops::mul(ex[k], dx), Ops::mul(ey[k], dy)));
+      rejected = Ops::or_(rejected, Ops::and_(collinear, same_direction));
+    }
+  }
+
+  V x0 = Ops::add(px, Ops::mul(t0, dx));
+  V y0 = Ops::add(py, Ops::mul(t0, dy));
+  V x1 = Ops::add(px, Ops::mul(t1, dx));
+  V y1 = Ops::add(py, Ops::mul(t1, dy));
+  V cross = Ops::sub(Ops::mul(x0, y1), Ops::mul(y0, x1));
+  M accepted = Ops::andnot(rejected, Ops::lt(t0, t1));
+  return Ops::select(accepted, cross, zero);
+}
+
+template <typename Ops>
+inline bool
+any_overlap_block(const Anchor &a, const Candidates &b, std::size_t i) {
+  // Returns whether the axis aligned box of any of the Ops::kWidth candidates starting at i
+  // overlaps the axis aligned box of the anchor.
+  typedef typename Ops::M M;
+  M disjoint = Ops::or_(
+      Ops::or_(Ops::lt(Ops::set1(a.max_x), Ops::load(b.min_x + i)), Ops::lt(Ops::load(b.max_x + i), Ops::set1(a.min_x))),
+      Ops::or_(Ops::lt(Ops::set1(a.max_y), Ops::load(b.min_y + i)), Ops::lt(Ops::load(b.max_y + i), Ops::set1(a.min_y))));
+  return !Ops::all(disjoint);
+}
+
+template <typename Ops>
+inline typename Ops::M
+axis_aligned_block(const float *const *bx, const float *const *by) {
+  // Returns which of the Ops::kWidth candidates are axis aligned rectangles, see geom::is_axis_aligned.
+  typedef typename Ops::M M;
+  M horizontal_first = Ops::and_(
+      Ops::and_(Ops::eq(Ops::load(by[0]), Ops::load(by[1])), Ops::eq(Ops::load(bx[1]), Ops::load(bx[2]))),
+      Ops::and_(Ops::eq(Ops::load(by[2]), Ops::load(by[3])), Ops::eq(Ops::load(bx[3]), Ops::load(bx[0]))));
+  M vertical_first = Ops::and_(
+      Ops::and_(Ops::eq(Ops::load(bx[0]), Ops::load(bx[1])), Ops::eq(Ops::load(by[1]), Ops::load(by[2]))),
+      Ops::and_(Ops::eq(Ops::load(bx[2]), Ops::load(bx[3])), Ops::eq(Ops::load(by[3]), Ops::load(by[0]))));
+  return Ops::or_(horizontal_first, vertical_first);
+}
+
+template <typename Ops>
+inline typename Ops::V
+ratio_block(typename Ops::V intersection_area, typename Ops::V union_area) {
+  // Same as the scalar intersection over union, zero unless the union has a positive area such
+  // that quadrilaterals without area never produce NaNs.
+  typedef typename Ops::V V;
+  V iou = Ops::min(Ops::div(intersection_area, union_area), Ops::set1(1.0f));
+  return Ops::select(Ops::lt(Ops::zero(), union_area), iou, Ops::zero());
+}
+
+template <typename Ops>
+inline typename Ops::V
+axis_aligned_intersection_over_union_block(const Anchor &a, const float *const *bx, const float *const *by,
+                                           const float *b_area) {
+  // Computes the intersection over union of the anchor and Ops::kWidth candidates, assuming all of
+  // them are axis aligned rectangles, i.e. opposite vertices 0 and 2 span their axis aligned boxes.
+  typedef typename Ops::V V;
+  V zero = Ops::zero();
+  V x0 = Ops::load(bx[0]), x2 = Ops::load(bx[2]);
+  V y0 = Ops::load(by[0]), y2 = Ops::load(by[2]);
+  V w = Ops::max(zero, Ops::sub(Ops::min(Ops::set1(a.max_x), Ops::max(x0, x2)),
+                                Ops::max(Ops::set1(a.min_x), Ops::min(x0, x2))));
+  V h = Ops::max(zero, Ops::sub(Ops::min(Ops::set1(a.max_y), Ops::max(y0, y2)),
+                                Ops::max(Ops::set1(a.min_y), Ops::min(y0, y2))));
+  V intersection_area = Ops::mul(w, h);
+  V union_area = Ops::sub(Ops::add(Ops::set1(a.area), Ops::load(b_area)), intersection_area);
+  return ratio_block<Ops>(intersection_area, union_area);
+}
+
+template <typename Ops>
+inline typename Ops::V
+intersection_over_union_block(const Anchor &a, const float *const *bx, const float *const *by,
+                              const float *b_area) {
+  // Computes the intersection over union of the anchor and Ops::kWidth candidates.
+  typedef typename Ops::V V;
+
+  V ax[4], ay[4], aex[4], aey[4];
+  V cx[4], cy[4], cex[4], cey[4];
+  for (std::size_t k = 0; k < 4; k++) {
+    ax[k] = Ops::set1(a.x[k]);
+    ay[k] = Ops::set1(a.y[k]);
+    aex[k] = Ops::set1(a.edge_x[k]);
+    aey[k] = Ops::set1(a.edge_y[k]);
+  }
+  for (std::size_t k = 0; k < 4; k++) {
+    cx[k] = Ops::sub(Ops::load(bx[k]), Ops::set1(a.origin_x));
+    cy[k] = Ops::sub(Ops::load(by[k]), Ops::set1(a.origin_y));
+  }
+  for (std::size_t k = 0; k < 4; k++) {
+    auto j = (k + 1) % 4;
+    cex[k] = Ops::sub(cx[j], cx[k]);
+    cey[k] = Ops::sub(cy[j], cy[k]);
+  }
+
+  V twice_area = Ops::zero();
+  for (std::size_t k = 0; k < 4; k++) {
+    auto j = (k + 1) % 4;
+    twice_area = Ops::add(twice_area, clipped_edge_cross<Ops>(ax[k], ay[k], ax[j], ay[j], cx, cy, cex, cey, false));
+  }
+  for (std::size_t k = 0; k < 4; k++) {
+    auto j = (k + 1) % 4;
+    twice_area = Ops::add(twice_area, clipped_edge_cross<Ops>(cx[k], cy[k], cx[j], cy[j], ax, ay, aex, aey, true));
+  }
+
+  V intersection_area = Ops::mul(Ops::abs(twice_area), Ops::set1(0.5f));
+  V union_area = Ops::sub(Ops::add(Ops::set1(a.area), Ops::load(b_area)), intersection_area);
+  return ratio_block<Ops>(intersection_area, union_area);
+}
+
+template <typename Ops>
+inline typename Ops::V
+any_intersection_over_union_block(const Anchor &a, const float *const *bx, const float *const *by,
+                                  const float *b_area) {
+  // Computes the intersection over union of the anchor and Ops::kWidth candidates, pairs of axis
+  // aligned rectangles in closed form. The choice is made per candidate such that the results
+  // don't depend on the block width.
+  typedef typename Ops::M M;
+  if (!a.axis_aligned) {
+    return intersection_over_union_block<Ops>(a, bx, by, b_area);
+  }
+  M axis_aligned = axis_aligned_block<Ops>(bx, by);
+  auto rectangles = axis_aligned_intersection_over_union_block<Ops>(a, bx, by, b_area);
+  if (Ops::all(axis_aligned)) {
+    return rectangles;
+  }
+  return Ops::select(axis_aligned, rectangles, intersection_over_union_block<Ops>(a, bx, by, b_area));
+}
+
+template <typename Ops>
+std::size_t
+intersection_over_union(const Anchor &a, const Candidates &b, std::size_t n, float *out) {
+  // Computes the intersection over union of the anchor and each of the n candidates. Returns the
+  // number of candidates that were rejected by their axis aligned boxes alone.
+  const std::size_t width = Ops::kWidth;
+  const float *bx[4];
+  const float *by[4];
+  std::size_t rejected = 0;
+
+  std::size_t i = 0;
+  for (; i + width <= n; i += width) {
+    if (!any_overlap_block<Ops>(a, b, i)) {
+      Ops::store(out + i, Ops::zero());
+      rejected += width;
+      continue;
+    }
+    for (std::size_t k = 0; k < 4; k++) {
+      bx[k] = b.x[k] + i;
+      by[k] = b.y[k] + i;
+    }
+    Ops::store(out + i, any_intersection_over_union_block<Ops>(a, bx, by, b.area + i));
+  }
+
+  if (i < n) {
+    // Pad the remaining candidates to a full block with empty quadrilaterals.
+    float tail_x[4][Ops::kWidth];
+    float tail_y[4][Ops::kWidth];
+    float tail_area[Ops::kWidth];
+    float tail_out[Ops::kWidth];
+    for (std::size_t l = 0; l < width; l++) {
+      for (std::size_t k = 0; k < 4; k++) {
+        tail_x[k][l] = i + l < n ? b.x[k][i + l] : a.origin_x;
+        tail_y[k][l] = i + l < n ? b.y[k][i + l] : a.origin_y;
+      }
+      tail_area[l] = i + l < n ? b.area[i + l] : 0.0f;
+    }
+    for (std::size_t k = 0; k < 4; k++) {
+      bx[k] = tail_x[k];
+      by[k] = tail_y[k];
+    }
+    Ops::store(tail_out, any_intersection_over_union_block<Ops>(a, bx, by, tail_area));
+    for (std::size_t l = 0; i + l < n; l++) {
+      out[i + l] = tail_out[l];
+    }
+  }
+
+  return rejected;
+}
+
+std::size_t
+intersection_over_union_sse(const Anchor &a, const Candidates &b, std::size_t n, float *out);
+
+// Only defined if built with LANMS_HAVE_AVX2, see geom_batch_avx2.cc.
+std::size_t
+intersection_over_union_avx2(const Anchor &a, const Candidates &b, std::size_t n, float *out);
+
+}
+}
+
+#endif
@@ -0,0 +1,57 @@
+// This file is compiled with -mavx2 and is only called after a runtime check for avx2 support.
+// It must therefore not contain (or instantiate) any code that could be shared with other
+// translation units, such as inline functions from other headers. Built without avx2 support it is
+// empty, geom_batch.cc only dispatches to it if LANMS_HAVE_AVX2 is defined.
+
+#include <cstddef>
+
+#include "geom_batch.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+namespace geom {
+namespace batch {
+
+#if defined(__AVX2__)
+namespace {
+
+struct Avx2Ops {
+  typedef __m256 V;
+  typedef __m256 M;
+  static const std::size_t kWidth = 8;
+
+  static V zero() { return _mm256_setzero_ps(); }
+  static V set1(float x) { return _mm256_set1_ps(x); }
+  static V load(const float *p) { return _mm256_loadu_ps(p); }
+  static void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm256_div_ps(a, b); }
+  static V min(V a, V b) { return _mm256_min_ps(a, b); }
+  static V max(V a, V b) { return _mm256_max_ps(a, b); }
+  static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+  static M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static M eq(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+  static M and_(M a, M b) { return _mm256_and_ps(a, b); }
+  static M or_(M a, M b) { return _mm256_or_ps(a, b); }
+  static M andnot(M a, M b) { return _mm256_andnot_ps(a, b); }
+  static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+  static bool all(M m) { return _mm256_movemask_ps(m) == 0xff; }
+};
+
+}
+
+std::size_t
+intersection_over_union_avx2(const Anchor &a, const Candidates &b, std::size_t n, float *out) {
+  return intersection_over_union<Avx2Ops>(a, b, n, out);
+}
+#elif defined(LANMS_HAVE_AVX2)
+#error "geom_batch_avx2.cc must be compiled with -mavx2 if LANMS_HAVE_AVX2 is defined"
+#endif
+
+}
+}
@@ -69,8 +69,8 @@ TEST(compute_intersection, parallel_edge_and_line) {
 
   auto i = geom::compute_intersection(p1, p2, v1, v2);
 
-  EXPECT_TRUE(std::isnan(i.x) || std::isinf(i.x));
-  EXPECT_TRUE(std::isnan(i.y) || std::isinf(i.y));
+  EXPECT_FLOAT_EQ(p1.x, i.x);
+  EXPECT_FLOAT_EQ(p1.y, i.y);
 }
 
 TEST(inside_edge, horizontal_edge) {
@@ -168,3 +168,179 @@ TEST(intersection_over_union, square_inside_square) {
   geom::Polygon p2{{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}};
   EXPECT_FLOAT_EQ(100.0 / 10000.0, geom::intersection_over_union(p1, p2));
 }
+
+TEST(intersection_over_union, quads) {
+  geom::Quad q1{{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}};
+  geom::Quad q2{{5.0, 0.0}, {15.0, 0.0}, {15.0, 10.0}, {5.0, 10.0}};
+  EXPECT_FLOAT_EQ(0.5 / 1.5, geom::intersection_over_union(q1, q2));
+}
+
+TEST(intersection_over_union, counter_clockwise_quads) {
+  geom::Quad q1{{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}};
+  geom::Quad q2{{5.0, 0.0}, {5.0, 10.0}, {15.0, 10.0}, {15.0, 0.0}};
+  auto ccw = geom::clockwise(q2);
+  EXPECT_FLOAT_EQ(5.0, ccw[0].x);
+  EXPECT_FLOAT_EQ(15.0, ccw[1].x);
+  EXPECT_FLOAT_EQ(0.5 / 1.5, geom::intersection_over_union(q1, q2));
+  EXPECT_FLOAT_EQ(0.5 / 1.5, geom::intersection_over_union(q2, q1));
+
+  float iou;
+  geom::intersection_over_union(q2, &q1, 1, &iou);
+  EXPECT_FLOAT_EQ(0.5 / 1.5, iou);
+}
+
+TEST(intersection_over_union, degenerate_quads) {
+  geom::Quad square{{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}};
+  geom::Quad triangle{{0.0, 0.0}, {10.0, 0.0}, {10.0, 0.0}, {0.0, 10.0}};
+  geom::Quad line{{0.0, 5.0}, {10.0, 5.0}, {10.0, 5.0}, {0.0, 5.0}};
+  geom::Quad point{{5.0, 5.0}, {5.0, 5.0}, {5.0, 5.0}, {5.0, 5.0}};
+  float nan = std::nanf("");
+  geom::Quad not_finite{{nan, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}};
+
+  EXPECT_FLOAT_EQ(0.5, geom::intersection_over_union(square, triangle));
+  EXPECT_FLOAT_EQ(0.5, geom::intersection_over_union(triangle, square));
+  std::vector<geom::Quad> quads{square, triangle, line, point, not_finite};
+  std::vector<float> ious(quads.size());
+  for (auto &&a : quads) {
+    geom::intersection_over_union(a, quads.data(), quads.size(), ious.data());
+    for (std::size_t j = 0; j < quads.size(); j++) {
+      auto iou = geom::intersection_over_union(a, quads[j]);
+      EXPECT_FALSE(std::isnan(iou));
+      EXPECT_NEAR(iou, ious[j], 1e-5);
+    }
+  }
+  EXPECT_FLOAT_EQ(0.0, geom::intersection_over_union(line, line));
+  EXPECT_FLOAT_EQ(0.0, geom::intersection_over_union(point, square));
+  EXPECT_FLOAT_EQ(0.0, geom::intersection_over_union(not_finite, square));
+}
+
+TEST(polygon_intersection, quad_on_rotated_quad_fits_inline_storage) {
+  geom::Quad q1{{100.0, 100.0}, {200.0, 100.0}, {200.0, 200.0}, {100.0, 200.0}};
+  geom::Quad q2{{150.0, 79.0}, {221.0, 150.0}, {150.0, 221.0}, {79.0, 150.0}};
+  ASSERT_EQ(geom::kMaxPolygonVertices, geom::polygon_intersection(q1, q2).size());
+}
+
+static std::vector<geom::Quad>
+_batch_test_quads() {
+  // Axis aligned and rotated rectangles with varying overlap, including duplicates and
+  // rectangles sharing edges.
+  std::vector<geom::Quad> quads;
+  for (std::size_t i = 0; i < 21; i++) {
+    float angle = (i % 3) * 0.2;
+    float cx = 50.0 + 3.0 * i;
+    float cy = 40.0 + 2.0 * (i % 5);
+    float w = 20.0 + i;
+    float h = 10.0;
+    float c = std::cos(angle);
+    float s = std::sin(angle);
+    float dx[4] = {-w / 2, w / 2, w / 2, -w / 2};
+    float dy[4] = {-h / 2, -h / 2, h / 2, h / 2};
+    geom::Quad q;
+    for (std::size_t k = 0; k < 4; k++) {
+      q[k] = geom::Point{cx + c * dx[k] - s * dy[k], cy + s * dx[k] + c * dy[k]};
+    }
+    quads.push_back(q);
+  }
+  quads.push_back(quads[0]);
+  quads.push_back(geom::Quad{{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}});
+  quads.push_back(geom::Quad{{10.0, 0.0}, {20.0, 0.0}, {20.0, 10.0}, {10.0, 10.0}});
+  return quads;
+}
+
+TEST(intersection_over_union_batch, matches_pairwise) {
+  auto quads = _batch_test_quads();
+  std::vector<float> ious(quads.size());
+  for (std::size_t i = 0; i < quads.size(); i++) {
+    geom::intersection_over_union(quads[i], quads.data(), quads.size(), ious.data());
+    for (std::size_t j = 0; j < quads.size(); j++) {
+      if (i == j) {
+        EXPECT_NEAR(1.0, ious[j], 1e-5);
+      } else {
+        EXPECT_NEAR(geom::intersection_over_union(quads[i], quads[j]), ious[j], 1e-5);
+      }
+    }
+  }
+}
+
+TEST(intersection_over_union_batch, duplicate_and_touching_quads) {
+  auto quads = _batch_test_quads();
+  auto n = quads.size();
+  std::vector<float> ious(n);
+  geom::intersection_over_union(quads[0], quads.data(), n, ious.data());
+  EXPECT_FLOAT_EQ(1.0, ious[n - 3]);
+  geom::intersection_over_union(quads[n - 2], quads.data(), n, ious.data());
+  EXPECT_FLOAT_EQ(0.0, ious[n - 1]);
+}
+
+TEST(intersection_over_union_batch, simd_levels_are_identical) {
+  auto quads = _batch_test_quads();
+  geom::QuadBatch batch;
+  for (auto &&q : quads) {
+    batch.push_back(q);
+  }
+
+  // Use a range that doesn't start or end on a block boundary.
+  std::size_t begin = 1;
+  std::size_t end = quads.size() - 2;
+  std::vector<float> scalar(end - begin);
+  std::vector<float> simd(end - begin);
+  for (auto &&q : quads) {
+    geom::intersection_over_union(q, batch, begin, end, scalar.data(), geom::kSimdScalar);
+    for (auto level : {geom::kSimdSSE, geom::kSimdAVX2}) {
+      geom::intersection_over_union(q, batch, begin, end, simd.data(), level);
+      for (std::size_t i = 0; i < scalar.size(); i++) {
+        EXPECT_EQ(scalar[i], simd[i]);
+      }
+    }
+  }
+}
+
+TEST(axis_aligned_box, rotated_square) {
+  geom::Quad q{{150.0, 79.0}, {221.0, 150.0}, {150.0, 221.0}, {79.0, 150.0}};
+  auto box = geom::axis_aligned_box(q);
+  EXPECT_FLOAT_EQ(79.0, box.min_x);
+  EXPECT_FLOAT_EQ(79.0, box.min_y);
+  EXPECT_FLOAT_EQ(221.0, box.max_x);
+  EXPECT_FLOAT_EQ(221.0, box.max_y);
+}
+
+TEST(is_axis_aligned, rectangles_and_rotated_quads) {
+  EXPECT_TRUE(geom::is_axis_aligned(geom::Quad{{0.0, 0.0}, {10.0, 0.0}, {10.0, 5.0}, {0.0, 5.0}}));
+  EXPECT_TRUE(geom::is_axis_aligned(geom::Quad{{0.0, 0.0}, {0.0, 5.0}, {10.0, 5.0}, {10.0, 0.0}}));
+  EXPECT_FALSE(geom::is_axis_aligned(geom::Quad{{0.0, 0.0}, {10.0, 0.5}, {10.0, 5.0}, {0.0, 5.0}}));
+  EXPECT_FALSE(geom::is_axis_aligned(geom::Quad{{150.0, 79.0}, {221.0, 150.0}, {150.0, 221.0}, {79.0, 150.0}}));
+}
+
+TEST(intersection_over_union_batch, axis_aligned_rectangles_match_polygon_path) {
+  std::vector<geom::Quad> quads;
+  for (std::size_t i = 0; i < 37; i++) {
+    float x = 7.0f * (i % 5) + 0.25f * i;
+    float y = 3.0f * (i % 4);
+    float w = 20.0f + (i % 7);
+    float h = 8.0f + (i % 3);
+    quads.push_back(geom::Quad{{x, y}, {x + w, y}, {x + w, y + h}, {x, y + h}});
+  }
+  std::vector<float> ious(quads.size());
+  for (auto &&q : quads) {
+    for (auto level : {geom::kSimdScalar, geom::kSimdSSE, geom::kSimdAVX2}) {
+      geom::QuadBatch batch;
+      for (auto &&c : quads) {
+        batch.push_back(c);
+      }
+      geom::intersection_over_union(q, batch, 0, batch.size(), ious.data(), level);
+      for (std::size_t j = 0; j < quads.size(); j++) {
+        EXPECT_NEAR(geom::intersection_over_union(q, quads[j]), ious[j], 1e-5);
+      }
+    }
+  }
+}
+
+TEST(intersection_area, overlapping_and_disjoint_boxes) {
+  geom::AxisAlignedBox a{0.0, 0.0, 10.0, 10.0};
+  geom::AxisAlignedBox b{5.0, 2.0, 15.0, 12.0};
+  geom::AxisAlignedBox c{20.0, 0.0, 30.0, 10.0};
+  EXPECT_FLOAT_EQ(40.0, geom::intersection_area(a, b));
+  EXPECT_FALSE(geom::disjoint(a, b));
+  EXPECT_FLOAT_EQ(0.0, geom::intersection_area(a, c));
+  EXPECT_TRUE(geom::disjoint(a, c));
+}
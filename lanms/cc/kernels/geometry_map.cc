@@ -0,0 +1,82 @@
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "geom.h"
+#include "geometry_map.h"
+#include "nms.h"
+
+
+namespace nms {
+
+geom::Quad
+decode_rbox(float x, float y, const float *geometry) {
+  // The rectangle in the rotated frame of the pixel, clockwise starting at the top left vertex.
+  float top = geometry[0], right = geometry[1], bottom = geometry[2], left = geometry[3];
+  float c = std::cos(geometry[4]);
+  float s = std::sin(geometry[4]);
+  const float corners[4][2] = {{-left, -top}, {right, -top}, {right, bottom}, {-left, bottom}};
+
+  geom::Quad q;
+  for (std::size_t k = 0; k < 4; k++) {
+    q[k] = geom::Point{x + c * corners[k][0] + s * corners[k][1], y - s * corners[k][0] + c * corners[k][1]};
+  }
+  return q;
+}
+
+geom::Quad
+decode_quad(float x, float y, const float *geometry) {
+  return geom::Quad{
+    {x + geometry[0], y + geometry[1]},
+    {x + geometry[2], y + geometry[3]},
+    {x + geometry[4], y + geometry[5]},
+    {x + geometry[6], y + geometry[7]}};
+}
+
+geom::Quad
+GeometryMap::quad(std::size_t y, std::size_t x) const {
+  const float *g = geometry + (y * width + x) * channels;
+  return channels == kQUADChannels ? decode_quad(x * scale, y * scale, g) : decode_rbox(x * scale, y * scale, g);
+}
+
+std::vector<BoundingBox>
+locality_aware_nms(const GeometryMap &geometry_map, float iou_threshold, Counters *counters, const Limits &limits,
+                   Workspace *workspace) {
+  // Pixels are visited row by row, which is the order EAST itself merges its predictions in. Only
+  // the merged bounding boxes are kept in memory.
+  std::vector<BoundingBox> merged_bounding_boxes;
+  BoundingBox current;
+  MergeAccumulator group;
+  bool has_current = false;
+
+  for (std::size_t y = 0; y < geometry_map.height; y++) {
+    const float *scores = geometry_map.scores + y * geometry_map.width;
+    for (std::size_t x = 0; x < geometry_map.width; x++) {
+      if (!(scores[x] >= limits.score_threshold)) {
+        continue;
+      }
+      BoundingBox b(geometry_map.quad(y, x), scores[x]);
+      if (has_current && should_merge(current, b, iou_threshold, counters)) {
+        group.add(b);
+        current = group.bounding_box();
+        continue;
+      }
+      if (has_current) {
+        merged_bounding_boxes.push_back(current);
+      }
+      current = b;
+      group = MergeAccumulator(b);
+      has_current = true;
+    }
+  }
+  if (has_current) {
+    merged_bounding_boxes.push_back(current);
+  }
+
+  Limits output_limits;
+  output_limits.max_output_size = limits.max_output_size;
+  return suppress_merged(merged_bounding_boxes, IndexLists(), iou_threshold, counters, nullptr, output_limits,
+                         workspace);
+}
+
+}
@@ -0,0 +1,50 @@
+#ifndef GEOMETRY_MAP_H_
+#define GEOMETRY_MAP_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "geom.h"
+#include "nms.h"
+
+
+namespace nms {
+
+// Number of geometry channels per pixel of the two EAST geometry types.
+const std::size_t kRBOXChannels = 5;
+const std::size_t kQUADChannels = 8;
+
+struct GeometryMap {
+  // A non-owning view of the outputs of EAST for an image, i.e. a score map of shape
+  // (height, width) and a geometry map of shape (height, width, channels), both contiguous.
+  //
+  // With 5 channels (RBOX) the geometry of a pixel holds its distances to the top, right, bottom
+  // and left edges of a rectangle followed by the rotation angle of the rectangle. With 8 channels
+  // (QUAD) it holds the offsets of the 4 vertices from the pixel. The pixel (x, y) is located at
+  // (x * scale, y * scale) in the input image.
+  const float *scores;
+  const float *geometry;
+  std::size_t height;
+  std::size_t width;
+  std::size_t channels;
+  float scale;
+
+  geom::Quad quad(std::size_t y, std::size_t x) const;
+};
+
+geom::Quad
+decode_rbox(float x, float y, const float *geometry);
+
+geom::Quad
+decode_quad(float x, float y, const float *geometry);
+
+// Decodes the bounding boxes of all pixels scored at least limits.score_threshold in row major
+// order and merges them as they are decoded, i.e. without sorting them first. The workspace is
+// used by the standard nms step.
+std::vector<BoundingBox>
+locality_aware_nms(const GeometryMap &geometry_map, float iou_threshold, Counters *counters = nullptr,
+                   const Limits &limits = Limits(), Workspace *workspace = nullptr);
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "geom.h"
+#include "geometry_map.h"
+#include "nms.h"
+
+
+TEST(decode_rbox, axis_aligned) {
+  float geometry[5] = {10.0, 20.0, 30.0, 40.0, 0.0};
+  auto q = nms::decode_rbox(100.0, 200.0, geometry);
+  EXPECT_FLOAT_EQ(60.0, q[0].x);
+  EXPECT_FLOAT_EQ(190.0, q[0].y);
+  EXPECT_FLOAT_EQ(120.0, q[2].x);
+  EXPECT_FLOAT_EQ(230.0, q[2].y);
+}
+
+TEST(decode_rbox, rotated_keeps_distances_to_edges) {
+  float geometry[5] = {10.0, 20.0, 30.0, 40.0, 0.5};
+  auto q = nms::decode_rbox(100.0, 200.0, geometry);
+  EXPECT_NEAR(60.0 * 40.0, geom::polygon_area(q), 1e-2);
+
+  // Distance of the pixel to the line through the top edge.
+  float ex = q[1].x - q[0].x, ey = q[1].y - q[0].y;
+  float top = std::fabs(ex * (200.0 - q[0].y) - ey * (100.0 - q[0].x)) / std::sqrt(ex * ex + ey * ey);
+  EXPECT_NEAR(10.0, top, 1e-3);
+}
+
+TEST(decode_rbox, matches_east_restore_rectangle_rbox) {
+  // Corners of restore_rectangle_rbox of EAST for the pixel (3, 2) of a geometry map with scale 4,
+  // for a positive and a negative angle of pi / 6, which EAST restores in separate branches.
+  const float geometry[2][5] = {{2.0, 6.0, 4.0, 3.0, M_PI / 6}, {2.0, 6.0, 4.0, 3.0, -M_PI / 6}};
+  const float expected[2][8] = {
+    {8.4019, 7.7679, 16.1962, 3.2679, 19.1962, 8.4641, 11.4019, 12.9641},
+    {10.4019, 4.7679, 18.1962, 9.2679, 15.1962, 14.4641, 7.4019, 9.9641},
+  };
+
+  for (std::size_t i = 0; i < 2; i++) {
+    auto q = nms::decode_rbox(12.0, 8.0, geometry[i]);
+
+    std::vector<float> scores(4 * 4, 0.0);
+    std::vector<float> geometry_map_data(4 * 4 * nms::kRBOXChannels, 0.0);
+    scores[2 * 4 + 3] = 0.9;
+    std::copy(geometry[i], geometry[i] + 5, &geometry_map_data[(2 * 4 + 3) * nms::kRBOXChannels]);
+    nms::GeometryMap geometry_map{scores.data(), geometry_map_data.data(), 4, 4, nms::kRBOXChannels, 4.0};
+    nms::Limits limits;
+    limits.score_threshold = 0.5;
+    auto res = nms::locality_aware_nms(geometry_map, 0.3, nullptr, limits);
+    ASSERT_EQ(1, res.size());
+
+    for (std::size_t k = 0; k < 4; k++) {
+      EXPECT_NEAR(expected[i][2 * k], q[k].x, 1e-3);
+      EXPECT_NEAR(expected[i][2 * k + 1], q[k].y, 1e-3);
+      EXPECT_NEAR(expected[i][2 * k], res[0].poly[k].x, 1e-3);
+      EXPECT_NEAR(expected[i][2 * k + 1], res[0].poly[k].y, 1e-3);
+    }
+  }
+}
+
+TEST(decode_quad, offsets) {
+  float geometry[8] = {-1.0, -2.0, 3.0, -4.0, 5.0, 6.0, -7.0, 8.0};
+  auto q = nms::decode_quad(10.0, 20.0, geometry);
+  EXPECT_FLOAT_EQ(9.0, q[0].x);
+  EXPECT_FLOAT_EQ(18.0, q[0].y);
+  EXPECT_FLOAT_EQ(3.0, q[3].x);
+  EXPECT_FLOAT_EQ(28.0, q[3].y);
+}
+
+TEST(geometry_map, merges_pixels_of_a_text_line) {
+  // Two text lines of 4 x 2 pixels each on an 8 x 8 map with scale 4, every pixel predicting its
+  // line exactly. Pixels of the first line predict the rectangle [0, 16] x [0, 8].
+  const std::size_t height = 8, width = 8;
+  std::vector<float> scores(height * width, 0.0);
+  std::vector<float> geometry(height * width * nms::kRBOXChannels, 0.0);
+  auto add_line = [&](std::size_t x0, std::size_t y0) {
+    for (std::size_t y = y0; y < y0 + 2; y++) {
+      for (std::size_t x = x0; x < x0 + 4; x++) {
+        scores[y * width + x] = 0.9;
+        float *g = &geometry[(y * width + x) * nms::kRBOXChannels];
+        g[0] = 4.0 * (y - y0);
+        g[1] = 4.0 * (x0 + 4 - x);
+        g[2] = 4.0 * (y0 + 2 - y);
+        g[3] = 4.0 * (x - x0);
+      }
+    }
+  };
+  add_line(0, 0);
+  add_line(2, 5);
+
+  nms::GeometryMap geometry_map{scores.data(), geometry.data(), height, width, nms::kRBOXChannels, 4.0};
+  nms::Limits limits;
+  limits.score_threshold = 0.8;
+  auto res = nms::locality_aware_nms(geometry_map, 0.3, nullptr, limits);
+
+  ASSERT_EQ(2, res.size());
+  EXPECT_FLOAT_EQ(8 * 0.9, res[0].score);
+  EXPECT_NEAR(0.0, res[0].poly[0].x, 1e-4);
+  EXPECT_NEAR(0.0, res[0].poly[0].y, 1e-4);
+  EXPECT_NEAR(16.0, res[0].poly[2].x, 1e-4);
+  EXPECT_NEAR(8.0, res[0].poly[2].y, 1e-4);
+  EXPECT_NEAR(8.0, res[1].poly[0].x, 1e-4);
+  EXPECT_NEAR(20.0, res[1].poly[0].y, 1e-4);
+
+  limits.max_output_size = 1;
+  EXPECT_EQ(1, nms::locality_aware_nms(geometry_map, 0.3, nullptr, limits).size());
+}
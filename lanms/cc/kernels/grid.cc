@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "geom.h"
+#include "grid.h"
+
+
+namespace geom {
+
+// Upper bounds of the number of cells, relative to the number of boxes and in absolute terms.
+static const double kMaxCellsPerBox = 4.0;
+static const double kMaxCellsPerAxis = 1 << 16;
+// Boxes overlapping more cells than this are kept in the list of large boxes.
+static const std::size_t kMaxCellsPerItem = 16;
+
+static double
+_median(std::vector<double> *values) {
+  auto middle = values->begin() + values->size() / 2;
+  std::nth_element(values->begin(), middle, values->end());
+  return *middle;
+}
+
+bool
+Grid::can_index(const AxisAlignedBox &box) {
+  // Return whether the box has finite coordinates.
+  return std::isfinite(box.min_x) && std::isfinite(box.min_y) && std::isfinite(box.max_x) && std::isfinite(box.max_y);
+}
+
+Grid::Grid() {
+  build(nullptr, 0);
+}
+
+Grid::Grid(const AxisAlignedBox *boxes, std::size_t n) {
+  build(boxes, n);
+}
+
+void
+Grid::build(const AxisAlignedBox *boxes, std::size_t n) {
+  origin_x_ = origin_y_ = 0.0;
+  inv_cell_width_ = inv_cell_height_ = 0.0;
+  nx_ = ny_ = 1;
+  if (n > 0) {
+    // Use the median box size as cell size such that a typical box overlaps a few cells, a few huge
+    // boxes neither coarsen the grid nor end up in many cells as they are kept in the large list.
+    double min_x = boxes[0].min_x, min_y = boxes[0].min_y, max_x = boxes[0].max_x, max_y = boxes[0].max_y;
+    widths_.resize(n);
+    heights_.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+      min_x = std::min(min_x, double(boxes[i].min_x));
+      min_y = std::min(min_y, double(boxes[i].min_y));
+      max_x = std::max(max_x, double(boxes[i].max_x));
+      max_y = std::max(max_y, double(boxes[i].max_y));
+      widths_[i] = double(boxes[i].max_x) - boxes[i].min_x;
+      heights_[i] = double(boxes[i].max_y) - boxes[i].min_y;
+    }
+    double cell_width = _median(&widths_);
+    double cell_height = _median(&heights_);
+
+    double width = max_x - min_x;
+    double height = max_y - min_y;
+    double cells_x = cell_width > 0.0 ? std::min(width / cell_width, kMaxCellsPerAxis) : 1.0;
+    double cells_y = cell_height > 0.0 ? std::min(height / cell_height, kMaxCellsPerAxis) : 1.0;
+
+    // Limit the total number of cells by coarsening both axes equally.
+    double max_cells = kMaxCellsPerBox * n;
+    if (cells_x * cells_y > max_cells) {
+      double scale = std::sqrt(max_cells / (cells_x * cells_y));
+      cells_x *= scale;
+      cells_y *= scale;
+    }
+
+    nx_ = std::max(std::size_t(1), std::size_t(std::ceil(cells_x)));
+    ny_ = std::max(std::size_t(1), std::size_t(std::ceil(cells_y)));
+    origin_x_ = min_x;
+    origin_y_ = min_y;
+    inv_cell_width_ = width > 0.0 ? nx_ / width : 0.0;
+    inv_cell_height_ = height > 0.0 ? ny_ / height : 0.0;
+  }
+
+  // Count the boxes per cell, then fill the cells in order of box index.
+  offsets_.assign(nx_ * ny_ + 1, 0);
+  large_.clear();
+  for (std::size_t i = 0; i < n; i++) {
+    std::size_t x0, y0, x1, y1;
+    cell_range(boxes[i], &x0, &y0, &x1, &y1);
+    if (is_large(x0, y0, x1, y1)) {
+      large_.push_back(i);
+      continue;
+    }
+    for (std::size_t y = y0; y <= y1; y++) {
+      for (std::size_t x = x0; x <= x1; x++) {
+        offsets_[y * nx_ + x + 1]++;
+      }
+    }
+  }
+  for (std::size_t c = 0; c < nx_ * ny_; c++) {
+    offsets_[c + 1] += offsets_[c];
+  }
+
+  items_.resize(offsets_.back() + 1);
+  fill_.assign(offsets_.begin(), offsets_.end() - 1);
+  for (std::size_t i = 0; i < n; i++) {
+    std::size_t x0, y0, x1, y1;
+    cell_range(boxes[i], &x0, &y0, &x1, &y1);
+    if (is_large(x0, y0, x1, y1)) {
+      continue;
+    }
+    for (std::size_t y = y0; y <= y1; y++) {
+      for (std::size_t x = x0; x <= x1; x++) {
+        items_[fill_[y * nx_ + x]++] = i;
+      }
+    }
+  }
+}
+
+bool
+Grid::is_large(std::size_t x0, std::size_t y0, std::size_t x1, std::size_t y1) const {
+  return (x1 - x0 + 1) * (y1 - y0 + 1) > kMaxCellsPerItem;
+}
+
+std::size_t
+Grid::cell_x(float x) const {
+  // Monotone in x, which guarantees that overlapping boxes share a cell.
+  double c = std::floor((x - origin_x_) * inv_cell_width_);
+  return std::size_t(std::min(std::max(c, 0.0), double(nx_ - 1)));
+}
+
+std::size_t
+Grid::cell_y(float y) const {
+  double c = std::floor((y - origin_y_) * inv_cell_height_);
+  return std::size_t(std::min(std::max(c, 0.0), double(ny_ - 1)));
+}
+
+void
+Grid::cell_range(const AxisAlignedBox &box, std::size_t *x0, std::size_t *y0, std::size_t *x1, std::size_t *y1) const {
+  // Return the inclusive range of cells overlapped by the box.
+  *x0 = cell_x(box.min_x);
+  *y0 = cell_y(box.min_y);
+  *x1 = cell_x(box.max_x);
+  *y1 = cell_y(box.max_y);
+}
+
+}
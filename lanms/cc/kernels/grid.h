@@ -0,0 +1,79 @@
+#ifndef GRID_H_
+#define GRID_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "geom.h"
+
+
+namespace geom {
+
+class Grid {
+  // A uniform grid spatial index over axis aligned boxes. Each box is stored in every cell it
+  // overlaps, so any two overlapping boxes share at least one cell. Boxes overlapping more than a
+  // few cells are kept in a list of large boxes instead, which every query visits. Within each cell
+  // and the list of large boxes the boxes are ordered by their index. An empty grid can be rebuilt
+  // over other boxes by build, which keeps the memory of the cell lists.
+ public:
+  Grid();
+  Grid(const AxisAlignedBox *boxes, std::size_t n);
+
+  void build(const AxisAlignedBox *boxes, std::size_t n);
+
+  // Calls fn(i) for each box i >= first that shares a cell with box or is large. Boxes in several of
+  // the cells are visited once per cell.
+  template <typename Fn>
+  void visit(const AxisAlignedBox &box, std::size_t first, Fn fn) const;
+
+  void cell_range(const AxisAlignedBox &box, std::size_t *x0, std::size_t *y0, std::size_t *x1, std::size_t *y1) const;
+  const std::size_t *cell_begin(std::size_t x, std::size_t y) const { return &items_[offsets_[y * nx_ + x]]; }
+  const std::size_t *cell_end(std::size_t x, std::size_t y) const { return &items_[0] + offsets_[y * nx_ + x + 1]; }
+  const std::size_t *large_begin() const { return large_.data(); }
+  const std::size_t *large_end() const { return large_.data() + large_.size(); }
+
+  static bool can_index(const AxisAlignedBox &box);
+
+ private:
+  std::size_t cell_x(float x) const;
+  std::size_t cell_y(float y) const;
+  bool is_large(std::size_t x0, std::size_t y0, std::size_t x1, std::size_t y1) const;
+
+  double origin_x_;
+  double origin_y_;
+  double inv_cell_width_;
+  double inv_cell_height_;
+  std::size_t nx_;
+  std::size_t ny_;
+
+  // Compressed cell lists, the boxes in cell c are items_[offsets_[c]:offsets_[c + 1]].
+  std::vector<std::size_t> offsets_;
+  std::vector<std::size_t> items_;
+  std::vector<std::size_t> fill_;
+  std::vector<std::size_t> large_;
+  std::vector<double> widths_;
+  std::vector<double> heights_;
+};
+
+template <typename Fn>
+void
+Grid::visit(const AxisAlignedBox &box, std::size_t first, Fn fn) const {
+  std::size_t x0, y0, x1, y1;
+  cell_range(box, &x0, &y0, &x1, &y1);
+  for (std::size_t y = y0; y <= y1; y++) {
+    for (std::size_t x = x0; x <= x1; x++) {
+      auto end = cell_end(x, y);
+      for (auto it = std::lower_bound(cell_begin(x, y), end, first); it != end; ++it) {
+        fn(*it);
+      }
+    }
+  }
+  for (auto it = std::lower_bound(large_begin(), large_end(), first); it != large_end(); ++it) {
+    fn(*it);
+  }
+}
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "geom.h"
+#include "grid.h"
+
+
+static bool
+_visits(const geom::Grid &grid, const geom::AxisAlignedBox &box, std::size_t i) {
+  bool visited = false;
+  grid.visit(box, 0, [&](std::size_t j) { visited = visited || j == i; });
+  return visited;
+}
+
+TEST(grid, overlapping_boxes_share_a_cell) {
+  std::vector<geom::AxisAlignedBox> boxes;
+  for (std::size_t i = 0; i < 10; i++) {
+    for (std::size_t j = 0; j < 10; j++) {
+      float x = 15.0 * i + j;
+      float y = 10.0 * j;
+      boxes.push_back(geom::AxisAlignedBox{x, y, x + 10.0f + i, y + 10.0f});
+    }
+  }
+  geom::Grid grid(boxes.data(), boxes.size());
+
+  for (std::size_t i = 0; i < boxes.size(); i++) {
+    for (std::size_t j = 0; j < boxes.size(); j++) {
+      if (!geom::disjoint(boxes[i], boxes[j])) {
+        EXPECT_TRUE(_visits(grid, boxes[i], j));
+      }
+    }
+  }
+}
+
+TEST(grid, cells_are_ordered_by_index) {
+  std::vector<geom::AxisAlignedBox> boxes{
+    {0.0, 0.0, 100.0, 100.0},
+    {10.0, 10.0, 20.0, 20.0},
+    {0.0, 0.0, 5.0, 5.0},
+    {90.0, 90.0, 100.0, 100.0}};
+  geom::Grid grid(boxes.data(), boxes.size());
+
+  std::size_t x0, y0, x1, y1;
+  grid.cell_range(boxes[0], &x0, &y0, &x1, &y1);
+  for (std::size_t y = y0; y <= y1; y++) {
+    for (std::size_t x = x0; x <= x1; x++) {
+      for (auto it = grid.cell_begin(x, y); it != grid.cell_end(x, y) && it + 1 != grid.cell_end(x, y); ++it) {
+        EXPECT_LT(*it, *(it + 1));
+      }
+    }
+  }
+}
+
+TEST(grid, huge_boxes_are_kept_out_of_the_cells) {
+  // Tiny boxes in a 100 x 100 raster and a few boxes covering most of it.
+  std::vector<geom::AxisAlignedBox> boxes;
+  for (std::size_t i = 0; i < 100; i++) {
+    for (std::size_t j = 0; j < 100; j++) {
+      boxes.push_back(geom::AxisAlignedBox{10.0f * i, 10.0f * j, 10.0f * i + 8.0f, 10.0f * j + 8.0f});
+    }
+  }
+  std::vector<std::size_t> huge;
+  for (std::size_t k = 0; k < 5; k++) {
+    huge.push_back(boxes.size());
+    boxes.push_back(geom::AxisAlignedBox{20.0f * k, 10.0f * k, 900.0f + 20.0f * k, 950.0f});
+  }
+  geom::Grid grid(boxes.data(), boxes.size());
+
+  EXPECT_EQ(huge, std::vector<std::size_t>(grid.large_begin(), grid.large_end()));
+  std::size_t x0, y0, x1, y1;
+  grid.cell_range(boxes[0], &x0, &y0, &x1, &y1);
+  EXPECT_LE((x1 - x0 + 1) * (y1 - y0 + 1), 4u);
+
+  for (std::size_t i = 0; i < boxes.size(); i += 7) {
+    for (std::size_t j = 0; j < boxes.size(); j++) {
+      if (!geom::disjoint(boxes[i], boxes[j])) {
+        EXPECT_TRUE(_visits(grid, boxes[i], j));
+        EXPECT_TRUE(_visits(grid, boxes[j], i));
+      }
+    }
+  }
+  grid.visit(boxes[0], huge[2], [&](std::size_t j) { EXPECT_GE(j, huge[2]); });
+}
+
+TEST(grid, rebuilt_grid_matches_new_grid) {
+  std::vector<geom::AxisAlignedBox> large{{0.0, 0.0, 1000.0, 1000.0}, {500.0, 0.0, 900.0, 300.0}};
+  std::vector<geom::AxisAlignedBox> boxes;
+  for (std::size_t i = 0; i < 20; i++) {
+    boxes.push_back(geom::AxisAlignedBox{5.0f * i, 3.0f * i, 5.0f * i + 8.0f, 3.0f * i + 4.0f});
+  }
+  geom::Grid grid(large.data(), large.size());
+  grid.build(boxes.data(), boxes.size());
+  geom::Grid new_grid(boxes.data(), boxes.size());
+
+  for (auto &&box : boxes) {
+    std::size_t x0, y0, x1, y1, new_x0, new_y0, new_x1, new_y1;
+    grid.cell_range(box, &x0, &y0, &x1, &y1);
+    new_grid.cell_range(box, &new_x0, &new_y0, &new_x1, &new_y1);
+    ASSERT_EQ(x0, new_x0);
+    ASSERT_EQ(y0, new_y0);
+    ASSERT_EQ(x1, new_x1);
+    ASSERT_EQ(y1, new_y1);
+    for (std::size_t y = y0; y <= y1; y++) {
+      for (std::size_t x = x0; x <= x1; x++) {
+        EXPECT_EQ(std::vector<std::size_t>(grid.cell_begin(x, y), grid.cell_end(x, y)),
+                  std::vector<std::size_t>(new_grid.cell_begin(x, y), new_grid.cell_end(x, y)));
+      }
+    }
+  }
+}
+
+TEST(grid, can_index) {
+  EXPECT_TRUE(geom::Grid::can_index(geom::AxisAlignedBox{0.0, 0.0, 1.0, 1.0}));
+  EXPECT_FALSE(geom::Grid::can_index(geom::AxisAlignedBox{0.0, 0.0, std::numeric_limits<float>::infinity(), 1.0}));
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "lanms_c.h"
+#include "nms.h"
+
+
+// Inputs smaller than this are merged on a single thread, see nms_kernels.cc.
+static const std::size_t kMinBoundingBoxesPerBand = 4096;
+
+static lanms_status
+_check_options(const lanms_options *options) {
+  if (!options || options->struct_size != sizeof(lanms_options) || !(options->iou_threshold >= 0 && options->iou_threshold <= 1) ||
+      std::isnan(options->score_threshold)) {
+    return LANMS_INVALID_ARGUMENT;
+  }
+  return LANMS_OK;
+}
+
+static nms::Limits
+_limits(const lanms_options *options) {
+  nms::Limits limits;
+  limits.score_threshold = options->score_threshold;
+  if (options->max_output_size >= 0) {
+    limits.max_output_size = options->max_output_size;
+  }
+  return limits;
+}
+
+static void
+_threads(std::size_t n, const std::function<void(std::size_t)> &fn) {
+  // Runs each work item on its own thread, the calling thread takes the first one.
+  std::vector<std::thread> workers;
+  for (std::size_t i = 1; i < n; i++) {
+    workers.emplace_back(fn, i);
+  }
+  fn(0);
+  for (auto &&w : workers) {
+    w.join();
+  }
+}
+
+template <typename F>
+static lanms_status
+_guarded(F f) {
+  // Exceptions must not propagate through the C interface.
+  try {
+    f();
+    return LANMS_OK;
+  } catch (const std::bad_alloc &) {
+    return LANMS_OUT_OF_MEMORY;
+  } catch (...) {
+    return LANMS_INTERNAL_ERROR;
+  }
+}
+
+void
+lanms_default_options(lanms_options *options) {
+  if (!options) {
+    return;
+  }
+  options->struct_size = sizeof(lanms_options);
+  options->iou_threshold = 0.3f;
+  options->score_threshold = -std::numeric_limits<float>::infinity();
+  options->max_output_size = -1;
+  options->num_threads = 1;
+}
+
+lanms_status
+lanms_locality_aware_nms(const float *vertices, const float *scores, size_t n, const lanms_options *options,
+                         float *vertices_output, float *scores_output, size_t *num_outputs) {
+  auto status = _check_options(options);
+  if (status != LANMS_OK) {
+    return status;
+  }
+  if ((n && (!vertices || !scores || !vertices_output || !scores_output)) || !num_outputs) {
+    return LANMS_INVALID_ARGUMENT;
+  }
+
+  return _guarded([&]() {
+    nms::BoundingBoxView bounding_boxes{vertices, scores, n};
+    auto num_bands = std::max(std::size_t(1),
+                              std::min(std::size_t(std::max(options->num_threads, 1)), n / kMinBoundingBoxesPerBand));
+    auto merged_bounding_boxes = nms::locality_aware_nms(
+        bounding_boxes, options->iou_threshold, num_bands, _threads, nullptr, nullptr, _limits(options));
+
+    for (std::size_t i = 0; i < merged_bounding_boxes.size(); i++) {
+      for (std::size_t j = 0; j < 4; j++) {
+        vertices_output[8 * i + 2 * j] = merged_bounding_boxes[i].poly[j].x;
+        vertices_output[8 * i + 2 * j + 1] = merged_bounding_boxes[i].poly[j].y;
+      }
+      scores_output[i] = merged_bounding_boxes[i].score;
+    }
+    *num_outputs = merged_bounding_boxes.size();
+  });
+}
+
+lanms_status
+lanms_standard_nms(const float *vertices, const float *scores, size_t n, const lanms_options *options,
+                   int64_t *indices_output, size_t *num_outputs) {
+  auto status = _check_options(options);
+  if (status != LANMS_OK) {
+    return status;
+  }
+  if ((n && (!vertices || !scores || !indices_output)) || !num_outputs) {
+    return LANMS_INVALID_ARGUMENT;
+  }
+
+  return _guarded([&]() {
+    nms::BoundingBoxView bounding_boxes{vertices, scores, n};
+    auto keep_indices = nms::standard_nms_indices(bounding_boxes, options->iou_threshold, nullptr, _limits(options));
+    std::copy(keep_indices.begin(), keep_indices.end(), indices_output);
+    *num_outputs = keep_indices.size();
+  });
+}
+
+const char *
+lanms_status_string(lanms_status status) {
+  switch (status) {
+    case LANMS_OK:
+      return "ok";
+    case LANMS_INVALID_ARGUMENT:
+      return "invalid argument";
+    case LANMS_OUT_OF_MEMORY:
+      return "out of memory";
+    case LANMS_INTERNAL_ERROR:
+      return "internal error";
+  }
+  return "unknown status";
+}
@@ -0,0 +1,78 @@
+#ifndef LANMS_C_H_
+#define LANMS_C_H_
+
+/*
+C API of the NMS kernels, independent of Tensorflow.
+
+All functions operate on caller provided buffers laid out as the inputs of the Tensorflow ops,
+i.e. vertices of shape (n, 4, 2) and scores of shape (n,), both as contiguous floats. Since the
+number of output boxes never exceeds the number of input boxes, output buffers with room for n
+boxes are always large enough. No exceptions cross this interface, errors are reported as status
+codes. Only the functions declared here are exported from the shared library.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define LANMS_EXPORT __declspec(dllexport)
+#else
+#define LANMS_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  LANMS_OK = 0,
+  LANMS_INVALID_ARGUMENT = 1,
+  LANMS_OUT_OF_MEMORY = 2,
+  LANMS_INTERNAL_ERROR = 3,
+} lanms_status;
+
+typedef struct {
+  /*
+  Must be sizeof(lanms_options), as set by lanms_default_options. Later versions only append
+  members and accept the struct_size of earlier versions, using defaults for the missing members.
+  */
+  size_t struct_size;
+  /* Boxes overlapping by at least this intersection over union are merged or suppressed. */
+  float iou_threshold;
+  /* Boxes scored below this are dropped before any other processing. */
+  float score_threshold;
+  /* At most this many boxes, those with the highest scores, are returned unless negative. */
+  int64_t max_output_size;
+  /* Number of threads used to merge large inputs in parallel, at most 1 means sequential. */
+  int num_threads;
+} lanms_options;
+
+/* Initializes options to struct_size sizeof(lanms_options), iou_threshold 0.3, no score threshold, no output limit and one thread. */
+LANMS_EXPORT void
+lanms_default_options(lanms_options *options);
+
+/*
+Locality aware NMS. Writes the merged boxes to vertices_output (num_outputs * 8 floats) and
+scores_output (num_outputs floats) and their number to num_outputs.
+*/
+LANMS_EXPORT lanms_status
+lanms_locality_aware_nms(const float *vertices, const float *scores, size_t n, const lanms_options *options,
+                         float *vertices_output, float *scores_output, size_t *num_outputs);
+
+/*
+Standard NMS. Writes the indices of the kept boxes, ordered by descending scores, to
+indices_output and their number to num_outputs.
+*/
+LANMS_EXPORT lanms_status
+lanms_standard_nms(const float *vertices, const float *scores, size_t n, const lanms_options *options,
+                   int64_t *indices_output, size_t *num_outputs);
+
+/* Returns a static description of the status. */
+LANMS_EXPORT const char *
+lanms_status_string(lanms_status status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "lanms_c.h"
+
+
+TEST(lanms_c, locality_aware_nms_two_pairs) {
+  // Two pairs of boxes that should be merged, laid out as (n, 4, 2).
+  std::vector<float> vertices{
+    50, 50, 150, 50, 150, 100, 50, 100,
+    60, 50, 160, 50, 160, 100, 60, 100,
+    50, 200, 150, 200, 150, 250, 50, 250,
+    60, 200, 160, 200, 160, 250, 60, 250,
+  };
+  std::vector<float> scores{1.0, 1.0, 1.0, 1.0};
+  lanms_options options;
+  lanms_default_options(&options);
+
+  std::vector<float> vertices_output(vertices.size());
+  std::vector<float> scores_output(scores.size());
+  std::size_t num_outputs = 0;
+  ASSERT_EQ(LANMS_OK, lanms_locality_aware_nms(vertices.data(), scores.data(), scores.size(), &options,
+                                               vertices_output.data(), scores_output.data(), &num_outputs));
+  ASSERT_EQ(2, num_outputs);
+  EXPECT_FLOAT_EQ(2.0, scores_output[0]);
+  EXPECT_FLOAT_EQ(55.0, vertices_output[0]);
+  EXPECT_FLOAT_EQ(155.0, vertices_output[2]);
+}
+
+TEST(lanms_c, standard_nms_indices) {
+  std::vector<float> vertices{
+    50, 50, 150, 50, 150, 100, 50, 100,
+    60, 50, 160, 50, 160, 100, 60, 100,
+    50, 200, 150, 200, 150, 250, 50, 250,
+  };
+  std::vector<float> scores{0.5, 0.9, 0.1};
+  lanms_options options;
+  lanms_default_options(&options);
+
+  std::vector<std::int64_t> indices(scores.size());
+  std::size_t num_outputs = 0;
+  ASSERT_EQ(LANMS_OK, lanms_standard_nms(vertices.data(), scores.data(), scores.size(), &options, indices.data(),
+                                         &num_outputs));
+  ASSERT_EQ(2, num_outputs);
+  EXPECT_EQ(1, indices[0]);
+  EXPECT_EQ(2, indices[1]);
+
+  options.score_threshold = 0.2;
+  ASSERT_EQ(LANMS_OK, lanms_standard_nms(vertices.data(), scores.data(), scores.size(), &options, indices.data(),
+                                         &num_outputs));
+  EXPECT_EQ(1, num_outputs);
+}
+
+TEST(lanms_c, invalid_arguments) {
+  lanms_options options;
+  lanms_default_options(&options);
+  std::size_t num_outputs = 0;
+  EXPECT_EQ(LANMS_OK, lanms_standard_nms(nullptr, nullptr, 0, &options, nullptr, &num_outputs));
+  EXPECT_EQ(0, num_outputs);
+  EXPECT_EQ(LANMS_INVALID_ARGUMENT, lanms_standard_nms(nullptr, nullptr, 0, nullptr, nullptr, &num_outputs));
+
+  options.iou_threshold = 1.5;
+  EXPECT_EQ(LANMS_INVALID_ARGUMENT, lanms_standard_nms(nullptr, nullptr, 0, &options, nullptr, &num_outputs));
+}
+
+TEST(lanms_c, options_of_unknown_size_are_rejected) {
+  lanms_options options;
+  lanms_default_options(&options);
+  EXPECT_EQ(sizeof(lanms_options), options.struct_size);
+
+  std::size_t num_outputs = 0;
+  options.struct_size = sizeof(lanms_options) + sizeof(std::int64_t);
+  EXPECT_EQ(LANMS_INVALID_ARGUMENT, lanms_standard_nms(nullptr, nullptr, 0, &options, nullptr, &num_outputs));
+  options.struct_size = 0;
+  EXPECT_EQ(LANMS_INVALID_ARGUMENT, lanms_locality_aware_nms(nullptr, nullptr, 0, &options, nullptr, nullptr,
+                                                             &num_outputs));
+}
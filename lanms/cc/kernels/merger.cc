@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "merger.h"
+#include "nms.h"
+
+
+namespace nms {
+
+// Vertical extent of a bounding box, bounding boxes with unknown extent overlap everything.
+static inline float
+_top(const BoundingBox &b) {
+  return std::isnan(b.aabb.min_y) ? -std::numeric_limits<float>::infinity() : b.aabb.min_y;
+}
+
+static inline float
+_bottom(const BoundingBox &b) {
+  return std::isnan(b.aabb.max_y) ? std::numeric_limits<float>::infinity() : b.aabb.max_y;
+}
+
+LocalityAwareMerger::LocalityAwareMerger(float iou_threshold, Counters *counters)
+    : iou_threshold_(iou_threshold), counters_(counters), has_current_(false),
+      watermark_(-std::numeric_limits<float>::infinity()) {}
+
+void
+LocalityAwareMerger::push(const BoundingBox *bounding_boxes, std::size_t n, std::vector<BoundingBox> *output) {
+  for (std::size_t i = 0; i < n; i++) {
+    const auto &b = bounding_boxes[i];
+    watermark_ = std::max(watermark_, min_y(b));
+    if (has_current_ && should_merge(current_, b, iou_threshold_, counters_)) {
+      group_.add(b);
+      current_ = group_.bounding_box();
+      continue;
+    }
+    if (has_current_) {
+      pending_.push_back(current_);
+    }
+    current_ = b;
+    group_ = MergeAccumulator(b);
+    has_current_ = true;
+  }
+
+  // Later bounding boxes start at the watermark or below, the current bounding box only grows
+  // towards them. With a non-positive iou threshold all bounding boxes suppress each other.
+  if (iou_threshold_ > 0.0) {
+    emit(has_current_ ? std::min(watermark_, _top(current_)) : watermark_, output);
+  }
+}
+
+void
+LocalityAwareMerger::flush(std::vector<BoundingBox> *output) {
+  if (has_current_) {
+    pending_.push_back(current_);
+    has_current_ = false;
+  }
+  auto final_bounding_boxes = standard_nms(pending_, iou_threshold_, counters_, Limits(), &workspace_);
+  output->insert(output->end(), final_bounding_boxes.begin(), final_bounding_boxes.end());
+  pending_.clear();
+  watermark_ = -std::numeric_limits<float>::infinity();
+}
+
+void
+LocalityAwareMerger::emit(float cutoff, std::vector<BoundingBox> *output) {
+  // Split the pending bounding boxes into bands of vertically overlapping bounding boxes. Bounding
+  // boxes in different bands can't suppress each other, so each band that ends above the cutoff
+  // is final and standard NMS can be applied to it on its own.
+  std::stable_sort(pending_.begin(), pending_.end(), [](const BoundingBox &a, const BoundingBox &b) {
+    return _top(a) < _top(b);
+  });
+
+  std::size_t emitted = 0;
+  std::vector<BoundingBox> band;
+  while (emitted < pending_.size()) {
+    auto band_end = emitted + 1;
+    float bottom = _bottom(pending_[emitted]);
+    while (band_end < pending_.size() && !(bottom < _top(pending_[band_end]))) {
+      bottom = std::max(bottom, _bottom(pending_[band_end]));
+      band_end++;
+    }
+    if (!(bottom < cutoff)) {
+      // All later bands start below this one and thus end below the cutoff as well.
+      break;
+    }
+
+    band.assign(pending_.begin() + emitted, pending_.begin() + band_end);
+    auto final_bounding_boxes = standard_nms(band, iou_threshold_, counters_, Limits(), &workspace_);
+    output->insert(output->end(), final_bounding_boxes.begin(), final_bounding_boxes.end());
+    emitted = band_end;
+  }
+
+  pending_.erase(pending_.begin(), pending_.begin() + emitted);
+}
+
+}
@@ -0,0 +1,59 @@
+#ifndef MERGER_H_
+#define MERGER_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "nms.h"
+
+
+namespace nms {
+
+class LocalityAwareMerger {
+  // Incremental Locality-Aware NMS for inputs that don't fit into memory at once, e.g. very large
+  // scans processed in tiles.
+  //
+  // Bounding boxes must be pushed in non-decreasing order of min_y (ties in the order of their
+  // indices to get exactly the same merges as locality_aware_nms). Merged bounding boxes are held
+  // back until no later bounding box can overlap them, i.e. memory is bounded by the rows that are
+  // still active rather than the total number of bounding boxes. The final bounding boxes are the
+  // same as those of locality_aware_nms for positive iou thresholds, they are emitted row band by
+  // row band, within a band by descending scores.
+ public:
+  explicit LocalityAwareMerger(float iou_threshold, Counters *counters = nullptr);
+
+  // Merges n bounding boxes and appends the bounding boxes that became final to output.
+  void push(const BoundingBox *bounding_boxes, std::size_t n, std::vector<BoundingBox> *output);
+
+  void push(const std::vector<BoundingBox> &bounding_boxes, std::vector<BoundingBox> *output) {
+    push(bounding_boxes.data(), bounding_boxes.size(), output);
+  }
+
+  // Appends all remaining bounding boxes to output. The merger can be reused afterwards.
+  void flush(std::vector<BoundingBox> *output);
+
+  // Number of merged bounding boxes held back.
+  std::size_t pending() const { return pending_.size() + (has_current_ ? 1 : 0); }
+
+ private:
+  void emit(float cutoff, std::vector<BoundingBox> *output);
+
+  float iou_threshold_;
+  Counters *counters_;
+
+  // The merged bounding box that may still grow, its group and the largest min_y pushed so far.
+  BoundingBox current_;
+  MergeAccumulator group_;
+  bool has_current_;
+  float watermark_;
+
+  // Merged bounding boxes that are complete but may still be suppressed by others.
+  std::vector<BoundingBox> pending_;
+
+  // Scratch memory of the suppression of each emitted band.
+  Workspace workspace_;
+};
+
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "merger.h"
+#include "nms.h"
+
+
+static std::vector<nms::BoundingBox>
+_sorted_by_score_and_position(std::vector<nms::BoundingBox> bounding_boxes) {
+  std::sort(bounding_boxes.begin(), bounding_boxes.end(), [](const nms::BoundingBox &a, const nms::BoundingBox &b) {
+    if (a.score != b.score) {
+      return a.score > b.score;
+    }
+    return a.poly[0].y < b.poly[0].y || (a.poly[0].y == b.poly[0].y && a.poly[0].x < b.poly[0].x);
+  });
+  return bounding_boxes;
+}
+
+TEST(locality_aware_merger, matches_locality_aware_nms) {
+  // Text lines pushed in row order in chunks of various sizes.
+  std::vector<nms::BoundingBox> bounding_boxes;
+  for (std::size_t i = 0; i < 3000; i++) {
+    float x = 37.0 * (i % 40) + (i % 7);
+    float y = 20.0 * (i / 40) + (i % 3);
+    geom::Quad q{{x, y}, {x + 30.0f, y + 1.0f}, {x + 30.0f, y + 13.0f}, {x, y + 12.0f}};
+    bounding_boxes.push_back(nms::BoundingBox(q, 0.5 + 0.5 * ((i * 31) % 97) / 97.0));
+  }
+  std::stable_sort(bounding_boxes.begin(), bounding_boxes.end(), [](const nms::BoundingBox &a, const nms::BoundingBox &b) {
+    return nms::min_y(a) < nms::min_y(b);
+  });
+  auto expected = _sorted_by_score_and_position(nms::locality_aware_nms(bounding_boxes, 0.3));
+
+  for (std::size_t chunk_size : {1, 7, 100, 3000}) {
+    nms::LocalityAwareMerger merger(0.3);
+    std::vector<nms::BoundingBox> res;
+    std::size_t max_pending = 0;
+    for (std::size_t i = 0; i < bounding_boxes.size(); i += chunk_size) {
+      merger.push(bounding_boxes.data() + i, std::min(chunk_size, bounding_boxes.size() - i), &res);
+      max_pending = std::max(max_pending, merger.pending());
+    }
+    merger.flush(&res);
+    EXPECT_EQ(0, merger.pending());
+
+    res = _sorted_by_score_and_position(res);
+    ASSERT_EQ(expected.size(), res.size());
+    for (std::size_t i = 0; i < res.size(); i++) {
+      EXPECT_EQ(expected[i].score, res[i].score);
+      EXPECT_EQ(expected[i].poly[0].x, res[i].poly[0].x);
+      EXPECT_EQ(expected[i].poly[2].y, res[i].poly[2].y);
+    }
+
+    // Only about one row of text is held back at a time.
+    if (chunk_size < 100) {
+      EXPECT_LT(max_pending, 100);
+    }
+  }
+}
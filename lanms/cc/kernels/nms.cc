@@ -1,69 +1,493 @@
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <utility>
 #include <vector>
 
 #include "geom.h"
+#include "grid.h"
 #include "nms.h"
 
 
 namespace nms {
 
+// At most this many outputs are selected by a heap instead of sorting all candidates.
+static const std::size_t kMaxTopKOutputSize = 1024;
+
+// At least this many bounding boxes are sorted row wise by a radix sort instead of a comparison sort.
+static const std::size_t kMinRadixSortSize = 1024;
+
+// Relative slack of the iou bound deciding which bounding boxes of a tile join the seam pass.
+static const float kSeamSlack = 1e-4;
+
+// Relative distance to the iou threshold within which the top-k path recomputes an iou with the kept
+// bounding box as anchor, see _standard_nms_top_k.
+static const float kAnchorSlack = 1e-4;
+
+static void
+_parallel_for(const ParallelFor *parallel_for, std::size_t n, const std::function<void(std::size_t)> &fn) {
+  // Calls fn(i) for each i in [0, n), concurrently if parallel_for is given.
+  if (parallel_for && n > 1) {
+    (*parallel_for)(n, fn);
+  } else {
+    for (std::size_t i = 0; i < n; i++) {
+      fn(i);
+    }
+  }
+}
+
+class _Stopwatch {
+  // Adds the time from construction to destruction, or until stopped, to *nanoseconds if given.
+ public:
+  explicit _Stopwatch(std::size_t *nanoseconds) : nanoseconds_(nullptr) { restart(nanoseconds); }
+  ~_Stopwatch() { stop(); }
+
+  void stop() {
+    if (nanoseconds_) {
+      auto elapsed = std::chrono::steady_clock::now() - start_;
+      *nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+      nanoseconds_ = nullptr;
+    }
+  }
+
+  // Stops and continues timing into *nanoseconds instead.
+  void restart(std::size_t *nanoseconds) {
+    stop();
+    nanoseconds_ = kInstrumentation ? nanoseconds : nullptr;
+    if (nanoseconds_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+ private:
+  std::size_t *nanoseconds_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+static inline std::size_t *
+_timer(Counters *counters, std::size_t Counters::*nanoseconds) {
+  return counters ? &(counters->*nanoseconds) : nullptr;
+}
+
+struct _SortBuffers {
+  std::vector<std::uint32_t> radix_keys;
+  std::vector<std::uint32_t> sorted_radix_keys;
+  std::vector<std::size_t> indices;
+  std::vector<std::size_t> sorted_indices;
+};
+
+struct Workspace::Buffers {
+  // Sort keys, candidates and bands of _locality_aware_merge, one set of sort buffers and merged
+  // bounding boxes per band.
+  std::vector<float> keys;
+  std::vector<std::size_t> merge_candidates;
+  std::vector<float> key_sample;
+  std::vector<float> band_starts;
+  std::vector<std::size_t> band_of;
+  std::vector<std::size_t> band_offsets;
+  std::vector<std::size_t> band_fill;
+  std::vector<std::size_t> order;
+  std::vector<_SortBuffers> band_sort;
+  std::vector<std::vector<BoundingBox>> band_merged;
+  std::vector<std::vector<std::size_t>> band_run_starts;
+  std::vector<std::vector<Counters>> band_run_counters;
+  std::vector<MergeAccumulator> band_last_group;
+  std::vector<Counters> band_counters;
+  std::vector<std::size_t> merged_starts;
+  IndexLists merged_indices;
+
+  // Open merged bounding boxes of _windowed_merge.
+  std::vector<BoundingBox> open;
+  std::vector<MergeAccumulator> open_groups;
+
+  // Inputs and state of _standard_nms.
+  geom::QuadBatch polys;
+  std::vector<float> scores;
+  std::vector<std::size_t> nms_candidates;
+  std::vector<std::size_t> candidate_indices;
+  std::vector<geom::AxisAlignedBox> boxes;
+  std::vector<bool> suppressed;
+  std::vector<bool> kept;
+  std::vector<std::size_t> last_visited;
+  std::vector<std::size_t> neighbours;
+  geom::QuadBatch neighbour_polys;
+  std::vector<float> ious;
+  geom::Grid grid;
+
+  // Heap of _soft_nms.
+  std::vector<std::pair<float, std::size_t>> soft_nms_heap;
+
+  // Workspaces of the classes or tiles processed concurrently, see _acquire_child.
+  std::mutex children_mutex;
+  std::vector<std::unique_ptr<Workspace>> children;
+};
+
+Workspace::Workspace() : buffers_(new Buffers()) {}
+
+Workspace::~Workspace() {}
+
+static std::unique_ptr<Workspace>
+_acquire_child(Workspace::Buffers &buffers) {
+  // Hands out a workspace for one of the classes or tiles of a call, released workspaces are kept for
+  // later classes, tiles and calls. There are at most as many as classes or tiles are processed
+  // concurrently.
+  std::lock_guard<std::mutex> lock(buffers.children_mutex);
+  if (buffers.children.empty()) {
+    return std::unique_ptr<Workspace>(new Workspace());
+  }
+  auto child = std::move(buffers.children.back());
+  buffers.children.pop_back();
+  return child;
+}
+
+static void
+_release_child(Workspace::Buffers &buffers, std::unique_ptr<Workspace> child) {
+  std::lock_guard<std::mutex> lock(buffers.children_mutex);
+  buffers.children.push_back(std::move(child));
+}
+
+static Workspace::Buffers &
+_workspace_buffers(Workspace *workspace, std::unique_ptr<Workspace> *local_workspace) {
+  // The buffers of workspace if given, otherwise those of a new workspace owned by local_workspace.
+  if (!workspace) {
+    local_workspace->reset(new Workspace());
+    workspace = local_workspace->get();
+  }
+  return workspace->buffers();
+}
+
+BoundingBox::BoundingBox(const geom::Quad &poly, float score)
+    : poly(geom::clockwise(poly)), score(score), aabb(geom::axis_aligned_box(poly)),
+      area(geom::polygon_area(poly)), axis_aligned(geom::is_axis_aligned(poly)) {}
+
 float
 min_y(const BoundingBox &b) {
-  auto y_min = b.poly[0].y;
-  for (std::size_t i = 1; i < 4; i++) {
-    if (b.poly[i].y < y_min) {
-      y_min = b.poly[i].y;
+  return b.aabb.min_y;
+}
+
+bool
+should_merge(const BoundingBox &a, const BoundingBox &b, float iou_threshold, Counters *counters) {
+  if (kInstrumentation && counters) {
+    counters->iou_tests++;
+  }
+
+  // The intersection can be no larger than the intersection of the axis aligned bounding boxes
+  // or either of the polygons, which gives an upper bound of the intersection over union. Only
+  // clip the polygons if this bound doesn't already rule out a merge. The bound is exact for axis
+  // aligned rectangles.
+  auto max_intersection_area = std::min(geom::intersection_area(a.aabb, b.aabb), std::min(a.area, b.area));
+  auto max_iou = max_intersection_area / (a.area + b.area - max_intersection_area);
+  if (max_iou < iou_threshold) {
+    if (kInstrumentation && counters) {
+      counters->prefilter_rejects++;
     }
+    return false;
+  }
+  if (a.axis_aligned && b.axis_aligned) {
+    return max_iou >= iou_threshold;
+  }
+
+  return geom::intersection_over_union(a.poly, b.poly, a.area, b.area) >= iou_threshold;
+}
+
+void
+MergeAccumulator::add(const BoundingBox &b) {
+  for (std::size_t k = 0; k < 4; k++) {
+    weighted_vertices[2 * k] += double(b.score) * b.poly[k].x;
+    weighted_vertices[2 * k + 1] += double(b.score) * b.poly[k].y;
   }
-  return y_min;
+  score += b.score;
 }
 
-bool
-should_merge(const BoundingBox &a, const BoundingBox &b, float iou_threshold) {
-  return geom::intersection_over_union(a.poly, b.poly) >= iou_threshold;
+BoundingBox
+MergeAccumulator::bounding_box() const {
+  auto inverse_score = 1.0 / score;
+  geom::Quad poly;
+  for (std::size_t k = 0; k < 4; k++) {
+    poly[k] = geom::Point{float(weighted_vertices[2 * k] * inverse_score),
+                          float(weighted_vertices[2 * k + 1] * inverse_score)};
+  }
+  return BoundingBox(poly, float(score));
 }
 
 BoundingBox
 weighted_merge(const BoundingBox &a, const BoundingBox &b) {
   // Weighted merge as described in EAST paper.
-  auto new_score = a.score + b.score;
-  return BoundingBox{
-    {{(a.score * a.poly[0].x + b.score * b.poly[0].x) / new_score, (a.score * a.poly[0].y + b.score * b.poly[0].y) / new_score},
-     {(a.score * a.poly[1].x + b.score * b.poly[1].x) / new_score, (a.score * a.poly[1].y + b.score * b.poly[1].y) / new_score},
-     {(a.score * a.poly[2].x + b.score * b.poly[2].x) / new_score, (a.score * a.poly[2].y + b.score * b.poly[2].y) / new_score},
-     {(a.score * a.poly[3].x + b.score * b.poly[3].x) / new_score, (a.score * a.poly[3].y + b.score * b.poly[3].y) / new_score}},
-    new_score
-  };
+  MergeAccumulator group(a);
+  group.add(b);
+  return group.bounding_box();
 }
 
-std::vector<BoundingBox>
-standard_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold) {
-  // Create a sorted (by descending scores) list of candidate indices.
-  std::vector<std::size_t> candidate_indices(bounding_boxes.size());
-  std::iota(candidate_indices.begin(), candidate_indices.end(), 0);
-  std::sort(candidate_indices.begin(), candidate_indices.end(), [&](std::size_t i, std::size_t j) {
-    return bounding_boxes[i].score > bounding_boxes[j].score;
-  });
+static std::vector<std::size_t>
+_standard_nms_dense(const geom::QuadBatch &polys, std::vector<std::size_t> &candidate_indices,
+                    float iou_threshold, std::size_t max_output_size, Counters *counters,
+                    Workspace::Buffers &buffers) {
+  // Candidate polygons are kept in the same order as candidate_indices in a structure-of-arrays
+  // layout such that each kept bounding box can suppress its candidates in vectorized blocks.
+  auto &candidates = buffers.neighbour_polys;
+  candidates.resize(0);
+  candidates.reserve(candidate_indices.size());
+  for (auto &&i : candidate_indices) {
+    candidates.push_back(polys, i);
+  }
+  auto &ious = buffers.ious;
+  ious.resize(candidate_indices.size());
 
   std::vector<std::size_t> keep_indices;
 
-  while (candidate_indices.size()) {
+  while (candidate_indices.size() && keep_indices.size() < max_output_size) {
     std::size_t p = 0;
     auto current_index = candidate_indices[0];
     keep_indices.push_back(current_index);
 
     // Only keep indices of bounding boxes that are not too close to the current bounding box.
+    auto rejects = geom::intersection_over_union(polys.quad(current_index), candidates,
+                                                 1, candidate_indices.size(), ious.data());
+    if (kInstrumentation && counters) {
+      counters->iou_tests += candidate_indices.size() - 1;
+      counters->prefilter_rejects += rejects;
+    }
     for (std::size_t i = 1; i < candidate_indices.size(); i++) {
-      if (!should_merge(bounding_boxes[current_index], bounding_boxes[candidate_indices[i]], iou_threshold)) {
-        candidate_indices[p++] = candidate_indices[i];
+      if (!(ious[i - 1] >= iou_threshold)) {
+        candidate_indices[p] = candidate_indices[i];
+        candidates.move(i, p);
+        p++;
       }
     }
     candidate_indices.resize(p);
+    candidates.resize(p);
+  }
+
+  return keep_indices;
+}
+
+static std::vector<std::size_t>
+_standard_nms_grid(const geom::QuadBatch &polys, const std::vector<std::size_t> &candidate_indices,
+                   float iou_threshold, std::size_t max_output_size, Counters *counters,
+                   Workspace::Buffers &buffers) {
+  // Same as _standard_nms_dense but each kept bounding box is only tested against the candidates
+  // in the grid cells it overlaps and the large candidates of the grid. This is equivalent as long as bounding boxes that don't overlap
+  // are never merged, i.e. for positive iou thresholds.
+  auto n = candidate_indices.size();
+  auto &boxes = buffers.boxes;
+  boxes.resize(n);
+  for (std::size_t r = 0; r < n; r++) {
+    boxes[r] = polys.aabb(candidate_indices[r]);
+  }
+
+  // Grid items are ranks, i.e. positions in the score ordered candidate_indices.
+  auto &grid = buffers.grid;
+  grid.build(boxes.data(), n);
+  auto &suppressed = buffers.suppressed;
+  auto &last_visited = buffers.last_visited;
+  auto &neighbours = buffers.neighbours;
+  auto &neighbour_polys = buffers.neighbour_polys;
+  auto &ious = buffers.ious;
+  suppressed.assign(n, false);
+  last_visited.assign(n, n);
+
+  std::vector<std::size_t> keep_indices;
+
+  for (std::size_t r = 0; r < n && keep_indices.size() < max_output_size; r++) {
+    if (suppressed[r]) {
+      continue;
+    }
+    keep_indices.push_back(candidate_indices[r]);
+
+    // Gather the remaining lower scored candidates sharing a cell with the current bounding box.
+    neighbours.clear();
+    neighbour_polys.resize(0);
+    grid.visit(boxes[r], r + 1, [&](std::size_t i) {
+      if (!suppressed[i] && last_visited[i] != r) {
+        last_visited[i] = r;
+        neighbours.push_back(i);
+        neighbour_polys.push_back(polys, candidate_indices[i]);
+      }
+    });
+
+    ious.resize(neighbours.size());
+    auto rejects = geom::intersection_over_union(polys.quad(candidate_indices[r]), neighbour_polys,
+                                                 0, neighbours.size(), ious.data());
+    if (kInstrumentation && counters) {
+      counters->iou_tests += neighbours.size();
+      counters->prefilter_rejects += rejects;
+    }
+    for (std::size_t i = 0; i < neighbours.size(); i++) {
+      if (ious[i] >= iou_threshold) {
+        suppressed[neighbours[i]] = true;
+      }
+    }
   }
 
+  return keep_indices;
+}
+
+static std::vector<std::size_t>
+_standard_nms_top_k(const geom::QuadBatch &polys, const float *scores, float iou_threshold,
+                    std::size_t max_output_size, Counters *counters, Workspace::Buffers &buffers) {
+  // Same as _standard_nms_dense but candidates are popped from a heap in order of descending
+  // scores and tested against the bounding boxes kept so far. Only the candidates visited before
+  // max_output_size bounding boxes are kept are ever ordered, which is much cheaper than sorting
+  // all candidates when few outputs are requested.
+  //
+  // Each candidate is tested against all its kept neighbours in a single batch with the candidate
+  // as anchor. The iou is not exactly symmetric though, so ious within kAnchorSlack of the threshold
+  // are recomputed with the kept bounding box as anchor as in _standard_nms_dense, such that both
+  // keep exactly the same bounding boxes.
+  auto n = polys.size();
+  auto &heap = buffers.candidate_indices;
+  heap.resize(n);
+  std::iota(heap.begin(), heap.end(), 0);
+  auto lower_score = [scores](std::size_t i, std::size_t j) {
+    return scores[i] < scores[j] || (scores[i] == scores[j] && i > j);
+  };
+  std::make_heap(heap.begin(), heap.end(), lower_score);
+
+  // Kept bounding boxes overlapping a candidate are looked up in a grid over all bounding boxes, as
+  // in _standard_nms_grid.
+  auto &boxes = buffers.boxes;
+  boxes.resize(n);
+  bool use_grid = iou_threshold > 0.0;
+  for (std::size_t i = 0; i < n; i++) {
+    boxes[i] = polys.aabb(i);
+    use_grid = use_grid && geom::Grid::can_index(boxes[i]);
+  }
+  auto &grid = buffers.grid;
+  if (use_grid) {
+    grid.build(boxes.data(), n);
+  }
+  auto &kept = buffers.kept;
+  auto &last_visited = buffers.last_visited;
+  auto &neighbours = buffers.neighbours;
+  auto &neighbour_polys = buffers.neighbour_polys;
+  auto &ious = buffers.ious;
+  kept.assign(n, false);
+  last_visited.assign(n, n);
+
+  std::vector<std::size_t> keep_indices;
+
+  while (heap.size() && keep_indices.size() < max_output_size) {
+    std::pop_heap(heap.begin(), heap.end(), lower_score);
+    auto current_index = heap.back();
+    heap.pop_back();
+
+    if (use_grid) {
+      neighbours.clear();
+      grid.visit(boxes[current_index], 0, [&](std::size_t i) {
+        if (kept[i] && last_visited[i] != current_index) {
+          last_visited[i] = current_index;
+          neighbours.push_back(i);
+        }
+      });
+    } else {
+      neighbours.assign(keep_indices.begin(), keep_indices.end());
+    }
+
+    neighbour_polys.resize(0);
+    for (auto &&k : neighbours) {
+      neighbour_polys.push_back(polys, k);
+    }
+    ious.resize(neighbours.size());
+    auto rejects = geom::intersection_over_union(polys.quad(current_index), neighbour_polys, 0, neighbours.size(),
+                                                 ious.data());
+    if (kInstrumentation && counters) {
+      counters->iou_tests += neighbours.size();
+      counters->prefilter_rejects += rejects;
+    }
+    bool suppressed = false;
+    for (std::size_t k = 0; k < neighbours.size() && !suppressed; k++) {
+      if (std::abs(ious[k] - iou_threshold) <= kAnchorSlack * iou_threshold) {
+        neighbour_polys.resize(0);
+        neighbour_polys.push_back(polys, current_index);
+        rejects = geom::intersection_over_union(polys.quad(neighbours[k]), neighbour_polys, 0, 1, &ious[k]);
+        if (kInstrumentation && counters) {
+          counters->iou_tests++;
+          counters->prefilter_rejects += rejects;
+        }
+      }
+      suppressed = ious[k] >= iou_threshold;
+    }
+    if (!suppressed) {
+      keep_indices.push_back(current_index);
+      kept[current_index] = true;
+    }
+  }
+
+  return keep_indices;
+}
+
+static std::vector<std::size_t>
+_standard_nms(const geom::QuadBatch &polys, const float *scores, float iou_threshold,
+              std::size_t max_output_size, Counters *counters, Workspace::Buffers &buffers) {
+  // Returns the indices of the bounding boxes to keep, ordered by descending scores. Ties are
+  // broken by index.
+  if (max_output_size < polys.size() && max_output_size <= kMaxTopKOutputSize) {
+    return _standard_nms_top_k(polys, scores, iou_threshold, max_output_size, counters, buffers);
+  }
+
+  // Create a sorted (by descending scores) list of candidate indices.
+  auto &candidate_indices = buffers.candidate_indices;
+  candidate_indices.resize(polys.size());
+  std::iota(candidate_indices.begin(), candidate_indices.end(), 0);
+  std::sort(candidate_indices.begin(), candidate_indices.end(), [&](std::size_t i, std::size_t j) {
+    return scores[i] > scores[j] || (scores[i] == scores[j] && i < j);
+  });
+
+  // Use a spatial index unless bounding boxes without any overlap could be merged or some
+  // coordinates can't be indexed.
+  bool use_grid = iou_threshold > 0.0;
+  for (std::size_t i = 0; use_grid && i < polys.size(); i++) {
+    use_grid = geom::Grid::can_index(polys.aabb(i));
+  }
+
+  return use_grid
+      ? _standard_nms_grid(polys, candidate_indices, iou_threshold, max_output_size, counters, buffers)
+      : _standard_nms_dense(polys, candidate_indices, iou_threshold, max_output_size, counters, buffers);
+}
+
+static std::vector<std::size_t>
+_standard_nms_indices(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, Counters *counters,
+                      const Limits &limits, Workspace::Buffers &buffers) {
+  auto &candidates = buffers.nms_candidates;
+  auto &polys = buffers.polys;
+  auto &scores = buffers.scores;
+  candidates.clear();
+  polys.resize(0);
+  scores.clear();
+  polys.reserve(bounding_boxes.size());
+  scores.reserve(bounding_boxes.size());
+  for (std::size_t i = 0; i < bounding_boxes.size(); i++) {
+    const auto &b = bounding_boxes[i];
+    if (!(b.score < limits.score_threshold)) {
+      candidates.push_back(i);
+      polys.push_back(b.poly, b.area, b.aabb);
+      scores.push_back(b.score);
+    }
+  }
+
+  auto keep_indices = _standard_nms(polys, scores.data(), iou_threshold, limits.max_output_size, counters, buffers);
+  for (auto &&i : keep_indices) {
+    i = candidates[i];
+  }
+  return keep_indices;
+}
+
+std::vector<BoundingBox>
+standard_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, Counters *counters,
+             const Limits &limits, Workspace *workspace) {
+  std::unique_ptr<Workspace> local_workspace;
+  std::vector<std::size_t> keep_indices = _standard_nms_indices(bounding_boxes, iou_threshold, counters, limits,
+                                                                _workspace_buffers(workspace, &local_workspace));
+
   std::vector<BoundingBox> bounding_boxes_to_keep;
+  bounding_boxes_to_keep.reserve(keep_indices.size());
 
   for (auto &&i : keep_indices) {
     bounding_boxes_to_keep.push_back(bounding_boxes[i]);
@@ -72,31 +496,1113 @@ standard_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold
   return bounding_boxes_to_keep;
 }
 
+std::vector<std::size_t>
+standard_nms_indices(const BoundingBoxView &bounding_boxes, float iou_threshold, Counters *counters,
+                     const Limits &limits, Workspace *workspace) {
+  // Return the indices of the bounding boxes to keep without copying the bounding boxes. Bounding
+  // boxes scored below the score threshold are dropped before ordering.
+  std::unique_ptr<Workspace> local_workspace;
+  auto &buffers = _workspace_buffers(workspace, &local_workspace);
+  auto &candidates = buffers.nms_candidates;
+  auto &scores = buffers.scores;
+  auto &polys = buffers.polys;
+  candidates.clear();
+  scores.clear();
+  polys.resize(0);
+  for (std::size_t i = 0; i < bounding_boxes.size; i++) {
+    if (!(bounding_boxes.scores[i] < limits.score_threshold)) {
+      candidates.push_back(i);
+      scores.push_back(bounding_boxes.scores[i]);
+      polys.push_back(bounding_boxes.poly(i));
+    }
+  }
+
+  auto keep_indices = _standard_nms(polys, scores.data(), iou_threshold, limits.max_output_size, counters, buffers);
+  for (auto &&i : keep_indices) {
+    i = candidates[i];
+  }
+  return keep_indices;
+}
+
+static inline float
+_soft_nms_decay(SoftNMSMethod method, float iou, float iou_threshold, float sigma) {
+  if (method == kSoftNMSGaussian) {
+    return std::exp(-iou * iou / sigma);
+  }
+  return iou >= iou_threshold ? 1.0f - iou : 1.0f;
+}
+
+static std::vector<std::size_t>
+_soft_nms(const geom::QuadBatch &polys, std::vector<float> &scores, SoftNMSMethod method, float iou_threshold,
+          float sigma, const Limits &limits, Counters *counters, Workspace::Buffers &buffers) {
+  // Returns the indices of the bounding boxes to keep ordered by their decayed scores, ties are
+  // broken by index. The scores are decayed in place.
+  //
+  // Bounding boxes that don't overlap a kept bounding box aren't decayed by it, so each kept
+  // bounding box only decays the remaining candidates the grid visits for it. Decayed
+  // candidates are pushed onto the heap again with their new score rather than re-sorting, the
+  // stale entries are skipped when popped. Candidates decayed below the score threshold are dropped.
+  auto n = polys.size();
+  auto &boxes = buffers.boxes;
+  boxes.resize(n);
+  bool use_grid = true;
+  for (std::size_t i = 0; i < n; i++) {
+    boxes[i] = polys.aabb(i);
+    use_grid = use_grid && geom::Grid::can_index(boxes[i]);
+  }
+  auto &grid = buffers.grid;
+  if (use_grid) {
+    grid.build(boxes.data(), n);
+  }
+
+  typedef std::pair<float, std::size_t> Entry;
+  auto &heap = buffers.soft_nms_heap;
+  heap.clear();
+  for (std::size_t i = 0; i < n; i++) {
+    heap.push_back(Entry(scores[i], i));
+  }
+  auto lower_score = [](const Entry &a, const Entry &b) {
+    return a.first < b.first || (a.first == b.first && a.second > b.second);
+  };
+  std::make_heap(heap.begin(), heap.end(), lower_score);
+
+  // Kept and dropped candidates are done.
+  auto &done = buffers.suppressed;
+  auto &last_visited = buffers.last_visited;
+  auto &neighbours = buffers.neighbours;
+  auto &neighbour_polys = buffers.neighbour_polys;
+  auto &ious = buffers.ious;
+  done.assign(n, false);
+  last_visited.assign(n, n);
+
+  std::vector<std::size_t> keep_indices;
+
+  while (heap.size() && keep_indices.size() < limits.max_output_size) {
+    std::pop_heap(heap.begin(), heap.end(), lower_score);
+    auto entry = heap.back();
+    heap.pop_back();
+    auto current_index = entry.second;
+    if (done[current_index] || !(entry.first == scores[current_index])) {
+      continue;
+    }
+    done[current_index] = true;
+    keep_indices.push_back(current_index);
+
+    // Gather the remaining candidates sharing a cell with the kept bounding box.
+    neighbours.clear();
+    neighbour_polys.resize(0);
+    auto visit = [&](std::size_t i) {
+      if (!done[i] && last_visited[i] != current_index) {
+        last_visited[i] = current_index;
+        neighbours.push_back(i);
+        neighbour_polys.push_back(polys, i);
+      }
+    };
+    if (use_grid) {
+      grid.visit(boxes[current_index], 0, visit);
+    } else {
+      for (std::size_t i = 0; i < n; i++) {
+        visit(i);
+      }
+    }
+
+    ious.resize(neighbours.size());
+    auto rejects = geom::intersection_over_union(polys.quad(current_index), neighbour_polys, 0, neighbours.size(),
+                                                 ious.data());
+    if (kInstrumentation && counters) {
+      counters->iou_tests += neighbours.size();
+      counters->prefilter_rejects += rejects;
+    }
+    for (std::size_t k = 0; k < neighbours.size(); k++) {
+      auto i = neighbours[k];
+      auto score = scores[i] * _soft_nms_decay(method, ious[k], iou_threshold, sigma);
+      if (score == scores[i]) {
+        continue;
+      }
+      scores[i] = score;
+      if (!(score >= limits.score_threshold)) {
+        done[i] = true;
+        continue;
+      }
+      heap.push_back(Entry(score, i));
+      std::push_heap(heap.begin(), heap.end(), lower_score);
+    }
+  }
+
+  return keep_indices;
+}
+
 std::vector<BoundingBox>
-locality_aware_nms(std::vector<BoundingBox> &bounding_boxes, float iou_threshold) {
-  // Implements the Locality-Aware NMS algorithm as described in EAST (https://arxiv.org/abs/1704.03155)
+soft_nms(const std::vector<BoundingBox> &bounding_boxes, SoftNMSMethod method, float iou_threshold, float sigma,
+         Counters *counters, const Limits &limits, Workspace *workspace) {
+  std::unique_ptr<Workspace> local_workspace;
+  auto &buffers = _workspace_buffers(workspace, &local_workspace);
+  auto &candidates = buffers.nms_candidates;
+  auto &polys = buffers.polys;
+  auto &scores = buffers.scores;
+  candidates.clear();
+  polys.resize(0);
+  scores.clear();
+  for (std::size_t i = 0; i < bounding_boxes.size(); i++) {
+    const auto &b = bounding_boxes[i];
+    if (!(b.score < limits.score_threshold)) {
+      candidates.push_back(i);
+      polys.push_back(b.poly, b.area, b.aabb);
+      scores.push_back(b.score);
+    }
+  }
 
-  // Sort bounding boxes row wise by sorting by their top most y coordinate.
-  std::sort(bounding_boxes.begin(), bounding_boxes.end(), [](const BoundingBox &a, const BoundingBox &b) -> bool {
-    return min_y(a) < min_y(b);
-  });
+  auto keep_indices = _soft_nms(polys, scores, method, iou_threshold, sigma, limits, counters, buffers);
+  std::vector<BoundingBox> bounding_boxes_to_keep;
+  bounding_boxes_to_keep.reserve(keep_indices.size());
+  for (auto &&i : keep_indices) {
+    bounding_boxes_to_keep.push_back(bounding_boxes[candidates[i]]);
+    bounding_boxes_to_keep.back().score = scores[i];
+  }
+  return bounding_boxes_to_keep;
+}
 
-  std::vector<BoundingBox> merged_bounding_boxes;
-  BoundingBox current = bounding_boxes[0];
+std::vector<std::size_t>
+soft_nms_indices(const BoundingBoxView &bounding_boxes, SoftNMSMethod method, float iou_threshold, float sigma,
+                 std::vector<float> *scores, Counters *counters, const Limits &limits, Workspace *workspace) {
+  std::unique_ptr<Workspace> local_workspace;
+  auto &buffers = _workspace_buffers(workspace, &local_workspace);
+  auto &candidates = buffers.nms_candidates;
+  auto &candidate_scores = buffers.scores;
+  auto &polys = buffers.polys;
+  candidates.clear();
+  candidate_scores.clear();
+  polys.resize(0);
+  for (std::size_t i = 0; i < bounding_boxes.size; i++) {
+    if (!(bounding_boxes.scores[i] < limits.score_threshold)) {
+      candidates.push_back(i);
+      candidate_scores.push_back(bounding_boxes.scores[i]);
+      polys.push_back(bounding_boxes.poly(i));
+    }
+  }
+
+  auto keep_indices = _soft_nms(polys, candidate_scores, method, iou_threshold, sigma, limits, counters, buffers);
+  scores->clear();
+  for (auto &&i : keep_indices) {
+    scores->push_back(candidate_scores[i]);
+    i = candidates[i];
+  }
+  return keep_indices;
+}
+
+/*
+Locality aware merging works on any source of bounding boxes providing
+- size(), the number of bounding boxes.
+- operator[](i), bounding box i.
+- score(i), the score of bounding box i.
+- min_y(i), the top most y coordinate of bounding box i.
+such that it can be applied directly to the input tensors without first copying them.
+*/
 
-  for (std::size_t i = 1; i < bounding_boxes.size(); i++) {
-    if (should_merge(current, bounding_boxes[i], iou_threshold)) {
-      current = weighted_merge(current, bounding_boxes[i]);
+struct _VectorSource {
+  const std::vector<BoundingBox> &bounding_boxes;
+
+  std::size_t size() const { return bounding_boxes.size(); }
+  const BoundingBox &operator[](std::size_t i) const { return bounding_boxes[i]; }
+  float score(std::size_t i) const { return bounding_boxes[i].score; }
+  float min_y(std::size_t i) const { return nms::min_y(bounding_boxes[i]); }
+};
+
+struct _ViewSource {
+  const BoundingBoxView &bounding_boxes;
+
+  std::size_t size() const { return bounding_boxes.size; }
+  BoundingBox operator[](std::size_t i) const { return bounding_boxes[i]; }
+  float score(std::size_t i) const { return bounding_boxes.scores[i]; }
+  float min_y(std::size_t i) const {
+    float v[8];
+    load_values(bounding_boxes.vertices, bounding_boxes.vertex_type, bounding_boxes.vertex_scale, 8 * i, 8, v);
+    return std::min(std::min(v[1], v[3]), std::min(v[5], v[7]));
+  }
+};
+
+struct _SubsetSource {
+  // The bounding boxes indices[0], ..., indices[size - 1] of a view, e.g. those of a single class.
+  _ViewSource view_source;
+  const std::size_t *indices;
+  std::size_t n;
+
+  std::size_t size() const { return n; }
+  BoundingBox operator[](std::size_t i) const { return view_source[indices[i]]; }
+  float score(std::size_t i) const { return view_source.score(indices[i]); }
+  float min_y(std::size_t i) const { return view_source.min_y(indices[i]); }
+};
+
+template <typename Source>
+static void
+_row_wise_keys(const Source &source, float score_threshold, std::vector<std::size_t> *candidates,
+               std::vector<float> *keys) {
+  // Writes the indices of the bounding boxes scored at least score_threshold to candidates and
+  // their row wise sort keys, i.e. min_y with NaNs sorted last, to keys[i]. Other keys are unset.
+  candidates->clear();
+  candidates->reserve(source.size());
+  for (std::size_t i = 0; i < source.size(); i++) {
+    if (!(source.score(i) < score_threshold)) {
+      candidates->push_back(i);
+    }
+  }
+
+  keys->resize(source.size());
+  for (auto &&i : *candidates) {
+    auto key = source.min_y(i);
+    (*keys)[i] = key == key ? key : std::numeric_limits<float>::infinity();
+  }
+}
+
+template <typename Fn>
+static inline void
+_traced(const Trace *trace, const char *name, const Fn &fn) {
+  // Runs fn within the stage name of trace if given.
+  if (trace) {
+    (*trace)(name, fn);
+  } else {
+    fn();
+  }
+}
+
+static inline std::uint32_t
+_radix_key(float key) {
+  // Maps floats to unsigned integers of the same order, 0 and -0 to the same integer.
+  key += 0.0f;
+  std::uint32_t bits;
+  std::memcpy(&bits, &key, sizeof(bits));
+  return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+static void
+_row_wise_sort(const std::vector<float> &keys, std::size_t *begin, std::size_t *end, _SortBuffers &buffers) {
+  // Sorts the ascending indices [begin, end) by keys[i], ties by index. Large inputs are sorted by
+  // a stable least significant digit radix sort of the key bits, passes over bytes that are the same
+  // for all keys (e.g. the exponent of keys within a single image) are skipped.
+  auto n = std::size_t(end - begin);
+  if (n < kMinRadixSortSize) {
+    std::sort(begin, end, [&keys](std::size_t i, std::size_t j) {
+      return keys[i] < keys[j] || (keys[i] == keys[j] && i < j);
+    });
+    return;
+  }
+
+  auto &radix_keys = buffers.radix_keys;
+  auto &sorted_radix_keys = buffers.sorted_radix_keys;
+  auto &indices = buffers.indices;
+  auto &sorted_indices = buffers.sorted_indices;
+  radix_keys.resize(n);
+  sorted_radix_keys.resize(n);
+  indices.assign(begin, end);
+  sorted_indices.resize(n);
+  for (std::size_t i = 0; i < n; i++) {
+    radix_keys[i] = _radix_key(keys[indices[i]]);
+  }
+
+  for (unsigned shift = 0; shift < 32; shift += 8) {
+    std::size_t offsets[257] = {};
+    for (auto &&k : radix_keys) {
+      offsets[((k >> shift) & 0xff) + 1]++;
+    }
+    if (std::find(offsets + 1, offsets + 257, n) != offsets + 257) {
+      continue;
+    }
+    std::partial_sum(offsets, offsets + 257, offsets);
+    for (std::size_t i = 0; i < n; i++) {
+      auto position = offsets[(radix_keys[i] >> shift) & 0xff]++;
+      sorted_radix_keys[position] = radix_keys[i];
+      sorted_indices[position] = indices[i];
+    }
+    radix_keys.swap(sorted_radix_keys);
+    indices.swap(sorted_indices);
+  }
+
+  std::copy(indices.begin(), indices.end(), begin);
+}
+
+template <typename Source>
+static void
+_merge_sweep(const Source &source, const std::size_t *begin, const std::size_t *end, float iou_threshold,
+             std::vector<BoundingBox> &merged_bounding_boxes, MergeAccumulator *last_group,
+             std::vector<std::size_t> *run_starts, std::vector<Counters> *run_counters, Counters *counters) {
+  // Merges consecutive row wise sorted bounding boxes source[*begin], ..., source[*(end - 1)]. The
+  // group of the last merged bounding box is written to last_group such that merging can be
+  // continued. If given, the position of the first bounding box of each merged bounding box is
+  // written to run_starts and the counters up to and including the test starting it to
+  // run_counters.
+  if (begin == end) {
+    return;
+  }
+
+  BoundingBox current = source[*begin];
+  MergeAccumulator group(current);
+  if (run_starts) {
+    run_starts->push_back(0);
+  }
+  if (kInstrumentation && run_counters && counters) {
+    run_counters->push_back(*counters);
+  }
+
+  for (auto it = begin + 1; it != end; ++it) {
+    auto &&b = source[*it];
+    if (should_merge(current, b, iou_threshold, counters)) {
+      group.add(b);
+      current = group.bounding_box();
     } else {
       merged_bounding_boxes.push_back(current);
-      current = bounding_boxes[i];
+      current = b;
+      group = MergeAccumulator(b);
+      if (run_starts) {
+        run_starts->push_back(it - begin);
+      }
+      if (kInstrumentation && run_counters && counters) {
+        run_counters->push_back(*counters);
+      }
     }
   }
 
   merged_bounding_boxes.push_back(current);
-  merged_bounding_boxes = standard_nms(merged_bounding_boxes, iou_threshold);
+  *last_group = group;
+}
+
+template <typename Source>
+static std::vector<BoundingBox>
+_locality_aware_merge(const Source &source, float iou_threshold, float score_threshold, std::size_t num_bands,
+                      const ParallelFor *parallel_for, Counters *counters, IndexLists *contributing_indices,
+                      Workspace::Buffers &buffers, const Trace *trace = nullptr) {
+  // Implements the merging step of the Locality-Aware NMS algorithm as described in EAST
+  // (https://arxiv.org/abs/1704.03155).
+  //
+  // The bounding boxes are sorted row wise by their top most y coordinate, ties are broken by
+  // index such that the result doesn't depend on how the sorting is partitioned. The image is split
+  // into num_bands horizontal bands which are sorted and merged concurrently, the result is
+  // identical to merging the whole image at once.
+  //
+  // Each merged bounding box is merged from a contiguous run of the row wise sorted bounding boxes.
+  // If given, the indices of these bounding boxes are written to contributing_indices.
+  _Stopwatch stopwatch(_timer(counters, &Counters::sort_nanoseconds));
+  auto &candidates = buffers.merge_candidates;
+  auto &keys = buffers.keys;
+  _row_wise_keys(source, score_threshold, &candidates, &keys);
+  auto n = candidates.size();
+  num_bands = std::max(std::size_t(1), std::min(num_bands, n));
+  if (kInstrumentation && counters) {
+    counters->input_bounding_boxes += n;
+  }
+
+  // Pick band boundaries such that the bands contain roughly the same number of bounding boxes
+  // using quantiles of a regular sample of the sort keys.
+  auto &sample = buffers.key_sample;
+  sample.clear();
+  auto sample_step = std::max(std::size_t(1), n / (64 * num_bands));
+  for (std::size_t c = 0; c < n; c += sample_step) {
+    sample.push_back(keys[candidates[c]]);
+  }
+  std::sort(sample.begin(), sample.end());
+  auto &band_starts = buffers.band_starts;
+  band_starts.resize(num_bands - 1);
+  for (std::size_t b = 1; b < num_bands; b++) {
+    band_starts[b - 1] = sample[b * sample.size() / num_bands];
+  }
+
+  // Partition the candidates into bands, band b holds all bounding boxes with
+  // band_starts[b - 1] <= min_y < band_starts[b].
+  auto &band_of = buffers.band_of;
+  band_of.resize(n);
+  auto &band_offsets = buffers.band_offsets;
+  band_offsets.assign(num_bands + 1, 0);
+  for (std::size_t c = 0; c < n; c++) {
+    band_of[c] = std::upper_bound(band_starts.begin(), band_starts.end(), keys[candidates[c]]) - band_starts.begin();
+    band_offsets[band_of[c] + 1]++;
+  }
+  std::partial_sum(band_offsets.begin(), band_offsets.end(), band_offsets.begin());
+  auto &order = buffers.order;
+  order.resize(n);
+  auto &fill = buffers.band_fill;
+  fill.assign(band_offsets.begin(), band_offsets.end() - 1);
+  for (std::size_t c = 0; c < n; c++) {
+    order[fill[band_of[c]]++] = candidates[c];
+  }
+  stopwatch.stop();
+
+  // Sort and merge each band independently.
+  auto &band_merged = buffers.band_merged;
+  auto &band_run_starts = buffers.band_run_starts;
+  auto &band_run_counters = buffers.band_run_counters;
+  band_merged.resize(std::max(band_merged.size(), num_bands));
+  band_run_starts.resize(std::max(band_run_starts.size(), num_bands));
+  band_run_counters.resize(std::max(band_run_counters.size(), num_bands));
+  buffers.band_sort.resize(std::max(buffers.band_sort.size(), num_bands));
+  auto &band_last_group = buffers.band_last_group;
+  auto &band_counters = buffers.band_counters;
+  band_last_group.resize(num_bands);
+  band_counters.assign(num_bands, Counters());
+  auto merge_band = [&](std::size_t b) {
+    auto begin = order.data() + band_offsets[b];
+    auto end = order.data() + band_offsets[b + 1];
+    auto band_counter = counters ? &band_counters[b] : nullptr;
+    band_merged[b].clear();
+    band_run_starts[b].clear();
+    band_run_counters[b].clear();
+    _Stopwatch band_stopwatch(_timer(band_counter, &Counters::sort_nanoseconds));
+    _traced(trace, "sort", [&] {
+      _row_wise_sort(keys, begin, end, buffers.band_sort[b]);
+    });
+    band_stopwatch.restart(_timer(band_counter, &Counters::merge_nanoseconds));
+    _merge_sweep(source, begin, end, iou_threshold, band_merged[b], &band_last_group[b], &band_run_starts[b],
+                 &band_run_counters[b], &band_counters[b]);
+  };
+  _parallel_for(parallel_for, num_bands, merge_band);
+  if (kInstrumentation && counters) {
+    for (auto &&c : band_counters) {
+      *counters += c;
+    }
+  }
+
+  // Stitch the bands together. The last (open) merged bounding box of the previous bands might
+  // merge with the first bounding boxes of the next band. Continue merging sequentially until a
+  // new merged bounding box starts at the same position as it did when merging the band on its
+  // own, from there on the merged bounding boxes of the band are valid. The tests of the stitch
+  // replace those of the band up to that position, such that the counters match merging the whole
+  // image at once.
+  stopwatch.restart(_timer(counters, &Counters::merge_nanoseconds));
+  std::vector<BoundingBox> merged_bounding_boxes;
+  auto &merged_starts = buffers.merged_starts;
+  merged_starts.clear();
+  BoundingBox current;
+  MergeAccumulator current_group;
+  std::size_t current_start = 0;
+  bool has_current = false;
+  for (std::size_t b = 0; b < num_bands; b++) {
+    const std::size_t *band = order.data() + band_offsets[b];
+    auto band_size = band_offsets[b + 1] - band_offsets[b];
+    const auto &run_starts = band_run_starts[b];
+    if (band_size == 0) {
+      continue;
+    }
+
+    std::size_t i = 0;
+    std::size_t run = 0;
+    if (has_current) {
+      Counters stitch_counters;
+      for (; i < band_size; i++) {
+        auto &&bounding_box = source[band[i]];
+        if (should_merge(current, bounding_box, iou_threshold, &stitch_counters)) {
+          current_group.add(bounding_box);
+          current = current_group.bounding_box();
+          continue;
+        }
+        merged_bounding_boxes.push_back(current);
+        merged_starts.push_back(current_start);
+        current = bounding_box;
+        current_group = MergeAccumulator(bounding_box);
+        current_start = band_offsets[b] + i;
+        while (run < run_starts.size() && run_starts[run] < i) {
+          run++;
+        }
+        if (run < run_starts.size() && run_starts[run] == i) {
+          break;
+        }
+      }
+      if (kInstrumentation && counters) {
+        const auto &replaced = i == band_size ? band_counters[b] : band_run_counters[b][run];
+        counters->iou_tests += stitch_counters.iou_tests - replaced.iou_tests;
+        counters->prefilter_rejects += stitch_counters.prefilter_rejects - replaced.prefilter_rejects;
+      }
+      if (i == band_size) {
+        // Never synchronized with the band, the current merged bounding box stays open.
+        continue;
+      }
+    }
+
+    // Runs [run, last) of the band are final, the last one stays open.
+    auto &merged = band_merged[b];
+    merged_bounding_boxes.insert(merged_bounding_boxes.end(), merged.begin() + run, merged.end() - 1);
+    for (; run + 1 < run_starts.size(); run++) {
+      merged_starts.push_back(band_offsets[b] + run_starts[run]);
+    }
+    current = merged.back();
+    current_group = band_last_group[b];
+    current_start = band_offsets[b] + run_starts.back();
+    has_current = true;
+  }
+  if (has_current) {
+    merged_bounding_boxes.push_back(current);
+    merged_starts.push_back(current_start);
+  }
+
+  if (contributing_indices) {
+    contributing_indices->indices.assign(order.begin(), order.end());
+    contributing_indices->offsets.assign(merged_starts.begin(), merged_starts.end());
+    contributing_indices->offsets.push_back(n);
+  }
+
+  return merged_bounding_boxes;
+}
+
+template <typename Source>
+static std::vector<BoundingBox>
+_windowed_merge(const Source &source, float iou_threshold, float score_threshold, std::size_t window,
+                Counters *counters, IndexLists *contributing_indices, Workspace::Buffers &buffers,
+                const Trace *trace = nullptr) {
+  // Same as _locality_aware_merge, but instead of a single current merged bounding box up to
+  // window merged bounding boxes are kept open. Each bounding box is merged into the most recently
+  // updated open bounding box it should be merged with, such that interleaved text lines on the
+  // same rows don't interrupt each others runs. Open bounding boxes are closed once they end above
+  // the next bounding box or, if the window is full, in least recently updated order. A window of
+  // size one is equivalent to _locality_aware_merge.
+  auto &order = buffers.merge_candidates;
+  auto &keys = buffers.keys;
+  buffers.band_sort.resize(std::max(buffers.band_sort.size(), std::size_t(1)));
+  _Stopwatch stopwatch(_timer(counters, &Counters::sort_nanoseconds));
+  _row_wise_keys(source, score_threshold, &order, &keys);
+  _traced(trace, "sort", [&] {
+    _row_wise_sort(keys, order.data(), order.data() + order.size(), buffers.band_sort[0]);
+  });
+  stopwatch.restart(_timer(counters, &Counters::merge_nanoseconds));
+  if (kInstrumentation && counters) {
+    counters->input_bounding_boxes += order.size();
+  }
+  window = std::max(window, std::size_t(1));
+
+  // Open merged bounding boxes ordered from least to most recently updated.
+  auto &open = buffers.open;
+  auto &open_groups = buffers.open_groups;
+  open.clear();
+  open_groups.clear();
+  std::vector<std::vector<std::size_t>> open_indices;
+
+  std::vector<BoundingBox> merged_bounding_boxes;
+  if (contributing_indices) {
+    contributing_indices->indices.clear();
+    contributing_indices->offsets.assign(1, 0);
+  }
+  auto close = [&](std::size_t k) {
+    merged_bounding_boxes.push_back(open[k]);
+    open.erase(open.begin() + k);
+    open_groups.erase(open_groups.begin() + k);
+    if (contributing_indices) {
+      auto &indices = open_indices[k];
+      contributing_indices->indices.insert(contributing_indices->indices.end(), indices.begin(), indices.end());
+      contributing_indices->offsets.push_back(contributing_indices->indices.size());
+    }
+    open_indices.erase(open_indices.begin() + k);
+  };
+
+  for (auto &&i : order) {
+    auto &&b = source[i];
+
+    // Bounding boxes that end above this one can't be merged with any later bounding box, unless
+    // bounding boxes without any overlap are merged as well.
+    for (std::size_t k = 0; iou_threshold > 0.0 && k < open.size();) {
+      if (open[k].aabb.max_y < b.aabb.min_y) {
+        close(k);
+      } else {
+        k++;
+      }
+    }
+
+    // Merge into the most recently updated open bounding box overlapping in x, if any.
+    std::size_t k = open.size();
+    while (k > 0) {
+      const auto &a = open[k - 1];
+      bool x_overlap = !(a.aabb.max_x < b.aabb.min_x || b.aabb.max_x < a.aabb.min_x);
+      if ((x_overlap || iou_threshold <= 0.0) && should_merge(a, b, iou_threshold, counters)) {
+        break;
+      }
+      k--;
+    }
+
+    if (k > 0) {
+      auto group = open_groups[k - 1];
+      group.add(b);
+      auto indices = std::move(open_indices[k - 1]);
+      open.erase(open.begin() + (k - 1));
+      open_groups.erase(open_groups.begin() + (k - 1));
+      open_indices.erase(open_indices.begin() + (k - 1));
+      open.push_back(group.bounding_box());
+      open_groups.push_back(group);
+      open_indices.push_back(std::move(indices));
+    } else {
+      if (open.size() == window) {
+        close(0);
+      }
+      open.push_back(b);
+      open_groups.push_back(MergeAccumulator(b));
+      open_indices.emplace_back();
+    }
+    if (contributing_indices) {
+      open_indices.back().push_back(i);
+    }
+  }
+
+  while (open.size()) {
+    close(0);
+  }
+
+  return merged_bounding_boxes;
+}
+
+static std::vector<BoundingBox>
+_suppress_merged(const std::vector<BoundingBox> &merged_bounding_boxes, const IndexLists &merged_indices,
+                 float iou_threshold, Counters *counters, IndexLists *contributing_indices, const Limits &limits,
+                 Workspace::Buffers &buffers) {
+  // Applies standard nms to the merged bounding boxes and gathers the kept merged bounding boxes
+  // together with their lists of contributing indices.
+  _Stopwatch stopwatch(_timer(counters, &Counters::suppress_nanoseconds));
+  Limits output_limits;
+  output_limits.max_output_size = limits.max_output_size;
+  auto keep_indices = _standard_nms_indices(merged_bounding_boxes, iou_threshold, counters, output_limits, buffers);
+  std::vector<BoundingBox> bounding_boxes_to_keep;
+  bounding_boxes_to_keep.reserve(keep_indices.size());
+  for (auto &&i : keep_indices) {
+    bounding_boxes_to_keep.push_back(merged_bounding_boxes[i]);
+  }
+  if (kInstrumentation && counters) {
+    counters->merged_bounding_boxes += merged_bounding_boxes.size();
+    counters->kept_bounding_boxes += keep_indices.size();
+  }
+
+  if (contributing_indices) {
+    contributing_indices->indices.clear();
+    contributing_indices->offsets.assign(1, 0);
+    for (auto &&i : keep_indices) {
+      contributing_indices->indices.insert(contributing_indices->indices.end(),
+                                           merged_indices.indices.begin() + merged_indices.offsets[i],
+                                           merged_indices.indices.begin() + merged_indices.offsets[i + 1]);
+      contributing_indices->offsets.push_back(contributing_indices->indices.size());
+    }
+  }
+
+  return bounding_boxes_to_keep;
+}
+
+template <typename Source>
+static std::vector<BoundingBox>
+_locality_aware_nms(const Source &source, float iou_threshold, std::size_t num_bands,
+                    const ParallelFor *parallel_for, Counters *counters, IndexLists *contributing_indices,
+                    const Limits &limits, Workspace *workspace = nullptr) {
+  // Implements the Locality-Aware NMS algorithm as described in EAST (https://arxiv.org/abs/1704.03155)
+  std::unique_ptr<Workspace> local_workspace;
+  auto &buffers = _workspace_buffers(workspace, &local_workspace);
+  auto &merged_indices = buffers.merged_indices;
+  auto merged_bounding_boxes = _locality_aware_merge(source, iou_threshold, limits.score_threshold, num_bands,
+                                                     parallel_for, counters,
+                                                     contributing_indices ? &merged_indices : nullptr, buffers);
+  return _suppress_merged(merged_bounding_boxes, merged_indices, iou_threshold, counters, contributing_indices,
+                          limits, buffers);
+}
+
+template <typename Source>
+static std::vector<BoundingBox>
+_locality_aware_nms_windowed(const Source &source, float iou_threshold, std::size_t window, Counters *counters,
+                             IndexLists *contributing_indices, const Limits &limits, Workspace *workspace) {
+  std::unique_ptr<Workspace> local_workspace;
+  auto &buffers = _workspace_buffers(workspace, &local_workspace);
+  auto &merged_indices = buffers.merged_indices;
+  auto merged_bounding_boxes = _windowed_merge(source, iou_threshold, limits.score_threshold, window, counters,
+                                               contributing_indices ? &merged_indices : nullptr, buffers);
+  return _suppress_merged(merged_bounding_boxes, merged_indices, iou_threshold, counters, contributing_indices,
+                          limits, buffers);
+}
+
+std::vector<BoundingBox>
+locality_aware_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, Counters *counters,
+                   IndexLists *contributing_indices) {
+  return _locality_aware_nms(_VectorSource{bounding_boxes}, iou_threshold, 1, nullptr, counters,
+                             contributing_indices, Limits());
+}
+
+std::vector<BoundingBox>
+locality_aware_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, std::size_t num_bands,
+                   const ParallelFor &parallel_for, Counters *counters, IndexLists *contributing_indices) {
+  // Same as above, but the image is split into num_bands horizontal bands which are sorted and
+  // merged concurrently. The result is identical to the sequential version.
+  return _locality_aware_nms(_VectorSource{bounding_boxes}, iou_threshold, num_bands, &parallel_for, counters,
+                             contributing_indices, Limits());
+}
+
+std::vector<BoundingBox>
+locality_aware_nms(const BoundingBoxView &bounding_boxes, float iou_threshold, Counters *counters,
+                   IndexLists *contributing_indices, const Limits &limits) {
+  // Same as above, but reads the bounding boxes directly from contiguous buffers. Only merged
+  // bounding boxes are materialized.
+  return _locality_aware_nms(_ViewSource{bounding_boxes}, iou_threshold, 1, nullptr, counters,
+                             contributing_indices, limits);
+}
+
+std::vector<BoundingBox>
+locality_aware_nms(const BoundingBoxView &bounding_boxes, float iou_threshold, std::size_t num_bands,
+                   const ParallelFor &parallel_for, Counters *counters, IndexLists *contributing_indices,
+                   const Limits &limits) {
+  return _locality_aware_nms(_ViewSource{bounding_boxes}, iou_threshold, num_bands, &parallel_for, counters,
+                             contributing_indices, limits);
+}
+
+std::vector<BoundingBox>
+locality_aware_nms_windowed(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, std::size_t window,
+                            Counters *counters, IndexLists *contributing_indices, Workspace *workspace) {
+  return _locality_aware_nms_windowed(_VectorSource{bounding_boxes}, iou_threshold, window, counters,
+                                      contributing_indices, Limits(), workspace);
+}
+
+std::vector<BoundingBox>
+locality_aware_nms_windowed(const BoundingBoxView &bounding_boxes, float iou_threshold, std::size_t window,
+                            Counters *counters, IndexLists *contributing_indices, const Limits &limits,
+                            Workspace *workspace) {
+  return _locality_aware_nms_windowed(_ViewSource{bounding_boxes}, iou_threshold, window, counters,
+                                      contributing_indices, limits, workspace);
+}
+
+std::vector<BoundingBox>
+locality_aware_merge(const BoundingBoxView &bounding_boxes, float iou_threshold, std::size_t num_bands,
+                     const ParallelFor *parallel_for, std::size_t window, Counters *counters,
+                     IndexLists *merged_indices, const Limits &limits, Workspace *workspace, const Trace *trace) {
+  std::unique_ptr<Workspace> local_workspace;
+  auto &buffers = _workspace_buffers(workspace, &local_workspace);
+  if (window > 1) {
+    return _windowed_merge(_ViewSource{bounding_boxes}, iou_threshold, limits.score_threshold, window, counters,
+                           merged_indices, buffers, trace);
+  }
+  return _locality_aware_merge(_ViewSource{bounding_boxes}, iou_threshold, limits.score_threshold, num_bands,
+                               parallel_for, counters, merged_indices, buffers, trace);
+}
+
+std::vector<BoundingBox>
+suppress_merged(const std::vector<BoundingBox> &merged_bounding_boxes, const IndexLists &merged_indices,
+                float iou_threshold, Counters *counters, IndexLists *contributing_indices, const Limits &limits,
+                Workspace *workspace) {
+  std::unique_ptr<Workspace> local_workspace;
+  return _suppress_merged(merged_bounding_boxes, merged_indices, iou_threshold, counters, contributing_indices,
+                          limits, _workspace_buffers(workspace, &local_workspace));
+}
+
+static IndexLists
+_partition_by_class(const int *class_ids, std::size_t n) {
+  // Groups the indices of the bounding boxes by class, classes in order of their ids and the
+  // indices of each class in ascending order. Class ids spanning a range of at most n values are
+  // grouped by a single counting pass, others by a stable sort.
+  IndexLists classes;
+  classes.offsets.assign(1, 0);
+  if (n == 0) {
+    return classes;
+  }
+
+  auto bounds = std::minmax_element(class_ids, class_ids + n);
+  auto min_id = std::int64_t(*bounds.first);
+  auto range = std::size_t(std::int64_t(*bounds.second) - min_id + 1);
+  classes.indices.resize(n);
+  if (range <= n) {
+    std::vector<std::size_t> offsets(range + 1, 0);
+    for (std::size_t i = 0; i < n; i++) {
+      offsets[class_ids[i] - min_id + 1]++;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<std::size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < n; i++) {
+      classes.indices[fill[class_ids[i] - min_id]++] = i;
+    }
+    for (std::size_t c = 1; c <= range; c++) {
+      if (offsets[c] != offsets[c - 1]) {
+        classes.offsets.push_back(offsets[c]);
+      }
+    }
+  } else {
+    std::iota(classes.indices.begin(), classes.indices.end(), 0);
+    std::stable_sort(classes.indices.begin(), classes.indices.end(), [class_ids](std::size_t i, std::size_t j) {
+      return class_ids[i] < class_ids[j];
+    });
+    for (std::size_t k = 1; k < n; k++) {
+      if (class_ids[classes.indices[k]] != class_ids[classes.indices[k - 1]]) {
+        classes.offsets.push_back(k);
+      }
+    }
+    classes.offsets.push_back(n);
+  }
+  return classes;
+}
+
+std::vector<std::size_t>
+class_aware_standard_nms_indices(const BoundingBoxView &bounding_boxes, const int *class_ids, float iou_threshold,
+                                 const ParallelFor *parallel_for, Counters *counters, const Limits &limits,
+                                 Workspace *workspace) {
+  std::unique_ptr<Workspace> local_workspace;
+  auto &parent_buffers = _workspace_buffers(workspace, &local_workspace);
+  auto classes = _partition_by_class(class_ids, bounding_boxes.size);
+  auto num_classes = classes.offsets.size() - 1;
+  std::vector<std::vector<std::size_t>> class_keep_indices(num_classes);
+  std::vector<Counters> class_counters(num_classes);
+  _parallel_for(parallel_for, num_classes, [&](std::size_t c) {
+    auto child = _acquire_child(parent_buffers);
+    auto &buffers = child->buffers();
+    auto &candidates = buffers.nms_candidates;
+    auto &scores = buffers.scores;
+    auto &polys = buffers.polys;
+    candidates.clear();
+    scores.clear();
+    polys.resize(0);
+    for (auto k = classes.offsets[c]; k < classes.offsets[c + 1]; k++) {
+      auto i = classes.indices[k];
+      if (!(bounding_boxes.scores[i] < limits.score_threshold)) {
+        candidates.push_back(i);
+        scores.push_back(bounding_boxes.scores[i]);
+        polys.push_back(bounding_boxes.poly(i));
+      }
+    }
+    auto &keep_indices = class_keep_indices[c];
+    keep_indices = _standard_nms(polys, scores.data(), iou_threshold, limits.max_output_size, &class_counters[c],
+                                 buffers);
+    for (auto &&i : keep_indices) {
+      i = candidates[i];
+    }
+    _release_child(parent_buffers, std::move(child));
+  });
+
+  std::vector<std::size_t> keep_indices;
+  for (std::size_t c = 0; c < num_classes; c++) {
+    keep_indices.insert(keep_indices.end(), class_keep_indices[c].begin(), class_keep_indices[c].end());
+    if (kInstrumentation && counters) {
+      *counters += class_counters[c];
+    }
+  }
+  const float *scores = bounding_boxes.scores;
+  std::sort(keep_indices.begin(), keep_indices.end(), [scores](std::size_t i, std::size_t j) {
+    return scores[i] > scores[j] || (scores[i] == scores[j] && i < j);
+  });
+  keep_indices.resize(std::min(keep_indices.size(), limits.max_output_size));
+  return keep_indices;
+}
+
+std::vector<BoundingBox>
+class_aware_locality_aware_nms(const BoundingBoxView &bounding_boxes, const int *class_ids, float iou_threshold,
+                               const ParallelFor *parallel_for, Counters *counters, IndexLists *contributing_indices,
+                               std::vector<int> *output_class_ids, const Limits &limits, Workspace *workspace) {
+  std::unique_ptr<Workspace> local_workspace;
+  auto &parent_buffers = _workspace_buffers(workspace, &local_workspace);
+  auto classes = _partition_by_class(class_ids, bounding_boxes.size);
+  auto num_classes = classes.offsets.size() - 1;
+  std::vector<std::vector<BoundingBox>> class_bounding_boxes(num_classes);
+  std::vector<IndexLists> class_indices(num_classes);
+  std::vector<Counters> class_counters(num_classes);
+  _parallel_for(parallel_for, num_classes, [&](std::size_t c) {
+    _SubsetSource source{_ViewSource{bounding_boxes}, classes.indices.data() + classes.offsets[c],
+                         classes.offsets[c + 1] - classes.offsets[c]};
+    auto child = _acquire_child(parent_buffers);
+    class_bounding_boxes[c] = _locality_aware_nms(source, iou_threshold, 1, nullptr, &class_counters[c],
+                                                  contributing_indices ? &class_indices[c] : nullptr, limits,
+                                                  child.get());
+    _release_child(parent_buffers, std::move(child));
+  });
+
+  // Order the outputs of all classes by descending scores, ties by class and output position.
+  std::vector<std::pair<std::size_t, std::size_t>> order;
+  for (std::size_t c = 0; c < num_classes; c++) {
+    for (std::size_t k = 0; k < class_bounding_boxes[c].size(); k++) {
+      order.push_back(std::make_pair(c, k));
+    }
+    if (kInstrumentation && counters) {
+      *counters += class_counters[c];
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](const std::pair<std::size_t, std::size_t> &a,
+                                                   const std::pair<std::size_t, std::size_t> &b) {
+    return class_bounding_boxes[a.first][a.second].score > class_bounding_boxes[b.first][b.second].score;
+  });
+  order.resize(std::min(order.size(), limits.max_output_size));
 
+  std::vector<BoundingBox> merged_bounding_boxes;
+  merged_bounding_boxes.reserve(order.size());
+  if (contributing_indices) {
+    contributing_indices->indices.clear();
+    contributing_indices->offsets.assign(1, 0);
+  }
+  if (output_class_ids) {
+    output_class_ids->clear();
+  }
+  for (auto &&o : order) {
+    auto c = o.first;
+    auto k = o.second;
+    merged_bounding_boxes.push_back(class_bounding_boxes[c][k]);
+    if (output_class_ids) {
+      output_class_ids->push_back(class_ids[classes.indices[classes.offsets[c]]]);
+    }
+    if (contributing_indices) {
+      const auto &indices = class_indices[c];
+      for (auto p = indices.offsets[k]; p < indices.offsets[k + 1]; p++) {
+        contributing_indices->indices.push_back(classes.indices[classes.offsets[c] + indices.indices[p]]);
+      }
+      contributing_indices->offsets.push_back(contributing_indices->indices.size());
+    }
+  }
   return merged_bounding_boxes;
 }
 
-}
\ No newline at end of file
+struct _TileSource {
+  // The bounding boxes of a tile, translated from tile into image coordinates.
+  _SubsetSource subset_source;
+  float x;
+  float y;
+
+  std::size_t size() const { return subset_source.size(); }
+  BoundingBox operator[](std::size_t i) const {
+    auto poly = subset_source.view_source.bounding_boxes.poly(subset_source.indices[i]);
+    for (std::size_t k = 0; k < 4; k++) {
+      poly[k] = geom::Point{poly[k].x + x, poly[k].y + y};
+    }
+    return BoundingBox(poly, score(i));
+  }
+  float score(std::size_t i) const { return subset_source.score(i); }
+  float min_y(std::size_t i) const { return subset_source.min_y(i) + y; }
+};
+
+static bool
+_may_suppress(const BoundingBox &a, const BoundingBox &b, float iou_threshold) {
+  // The iou bound of should_merge, with some slack for rounding such that no pair of bounding boxes
+  // suppressing each other is missed.
+  auto max_intersection_area = std::min(geom::intersection_area(a.aabb, b.aabb), std::min(a.area, b.area));
+  return max_intersection_area / (a.area + b.area - max_intersection_area) >= iou_threshold * (1 - kSeamSlack);
+}
+
+static void
+_mark_seam(const std::vector<BoundingBox> &merged_bounding_boxes, float x, float y, const TileLayout &tiles,
+           float iou_threshold, std::vector<bool> *seam, Workspace::Buffers &buffers) {
+  // Marks the merged bounding boxes of a tile near its border, and those reachable from them through
+  // pairs that may suppress each other. The others can only be suppressed within the tile. With a
+  // non-positive iou threshold all bounding boxes suppress each other.
+  auto n = merged_bounding_boxes.size();
+  auto &boxes = buffers.boxes;
+  auto &stack = buffers.neighbours;
+  boxes.resize(n);
+  stack.clear();
+  seam->assign(n, false);
+  for (std::size_t i = 0; i < n; i++) {
+    const auto &aabb = merged_bounding_boxes[i].aabb;
+    if (!(iou_threshold > 0) || !geom::Grid::can_index(aabb)) {
+      seam->assign(n, true);
+      return;
+    }
+    boxes[i] = aabb;
+    if (!(aabb.min_x >= x + tiles.margin && aabb.max_x <= x + tiles.width - tiles.margin &&
+          aabb.min_y >= y + tiles.margin && aabb.max_y <= y + tiles.height - tiles.margin)) {
+      (*seam)[i] = true;
+      stack.push_back(i);
+    }
+  }
+  if (stack.empty()) {
+    return;
+  }
+
+  auto &grid = buffers.grid;
+  grid.build(boxes.data(), n);
+  while (!stack.empty()) {
+    auto i = stack.back();
+    stack.pop_back();
+    grid.visit(boxes[i], 0, [&](std::size_t j) {
+      if (!(*seam)[j] && _may_suppress(merged_bounding_boxes[i], merged_bounding_boxes[j], iou_threshold)) {
+        (*seam)[j] = true;
+        stack.push_back(j);
+      }
+    });
+  }
+}
+
+std::vector<BoundingBox>
+tiled_locality_aware_nms(const BoundingBoxView &bounding_boxes, const int *tile_ids, const TileLayout &tiles,
+                         float iou_threshold, const ParallelFor *parallel_for, Counters *counters,
+                         const Limits &limits, Workspace *workspace) {
+  // Bounding boxes only suppress bounding boxes they overlap, so the merged bounding boxes split into
+  // those of the seam and those of each tile off the seam, none of which suppress each other. Greedy
+  // nms of each of these sets on its own gives the same result as nms of all of them at once.
+  std::unique_ptr<Workspace> local_workspace;
+  auto &buffers = _workspace_buffers(workspace, &local_workspace);
+  Limits output_limits;
+  output_limits.max_output_size = limits.max_output_size;
+  auto tile_groups = _partition_by_class(tile_ids, bounding_boxes.size);
+  auto num_tiles = tile_groups.offsets.size() - 1;
+  std::vector<std::vector<BoundingBox>> tile_bounding_boxes(num_tiles);
+  std::vector<std::vector<bool>> tile_seams(num_tiles);
+  std::vector<std::vector<std::size_t>> tile_keep_indices(num_tiles);
+  std::vector<Counters> tile_counters(num_tiles);
+  _parallel_for(parallel_for, num_tiles, [&](std::size_t t) {
+    auto begin = tile_groups.offsets[t];
+    auto tile_id = tile_ids[tile_groups.indices[begin]];
+    float x = tiles.offsets[2 * tile_id];
+    float y = tiles.offsets[2 * tile_id + 1];
+    _TileSource source{_SubsetSource{_ViewSource{bounding_boxes}, tile_groups.indices.data() + begin,
+                                     tile_groups.offsets[t + 1] - begin}, x, y};
+    auto child = _acquire_child(buffers);
+    auto &tile_buffers = child->buffers();
+    auto &merged_bounding_boxes = tile_bounding_boxes[t];
+    merged_bounding_boxes = _locality_aware_merge(source, iou_threshold, limits.score_threshold, 1, nullptr,
+                                                  &tile_counters[t], nullptr, tile_buffers);
+
+    _Stopwatch stopwatch(_timer(&tile_counters[t], &Counters::suppress_nanoseconds));
+    auto &seam = tile_seams[t];
+    _mark_seam(merged_bounding_boxes, x, y, tiles, iou_threshold, &seam, tile_buffers);
+    std::vector<BoundingBox> interior_bounding_boxes;
+    std::vector<std::size_t> interior_indices;
+    for (std::size_t i = 0; i < merged_bounding_boxes.size(); i++) {
+      if (!seam[i]) {
+        interior_bounding_boxes.push_back(merged_bounding_boxes[i]);
+        interior_indices.push_back(i);
+      }
+    }
+    auto &keep_indices = tile_keep_indices[t];
+    keep_indices = _standard_nms_indices(interior_bounding_boxes, iou_threshold, &tile_counters[t], output_limits,
+                                         tile_buffers);
+    for (auto &&i : keep_indices) {
+      i = interior_indices[i];
+    }
+    _release_child(buffers, std::move(child));
+  });
+
+  // Merged bounding boxes are identified by their position in the concatenation of all tiles, which
+  // breaks ties of scores as nms of the concatenation would.
+  std::vector<std::pair<std::size_t, const BoundingBox *>> kept;
+  std::vector<BoundingBox> seam_bounding_boxes;
+  std::vector<std::size_t> seam_positions;
+  std::size_t position = 0;
+  for (std::size_t t = 0; t < num_tiles; t++) {
+    for (auto &&i : tile_keep_indices[t]) {
+      kept.push_back(std::make_pair(position + i, &tile_bounding_boxes[t][i]));
+    }
+    for (std::size_t i = 0; i < tile_bounding_boxes[t].size(); i++) {
+      if (tile_seams[t][i]) {
+        seam_bounding_boxes.push_back(tile_bounding_boxes[t][i]);
+        seam_positions.push_back(position + i);
+      }
+    }
+    position += tile_bounding_boxes[t].size();
+    if (kInstrumentation && counters) {
+      *counters += tile_counters[t];
+    }
+  }
+
+  {
+    _Stopwatch stopwatch(_timer(counters, &Counters::suppress_nanoseconds));
+    auto seam_keep_indices = _standard_nms_indices(seam_bounding_boxes, iou_threshold, counters, output_limits,
+                                                   buffers);
+    for (auto &&i : seam_keep_indices) {
+      kept.push_back(std::make_pair(seam_positions[i], &seam_bounding_boxes[i]));
+    }
+  }
+
+  std::sort(kept.begin(), kept.end(), [](const std::pair<std::size_t, const BoundingBox *> &a,
+                                         const std::pair<std::size_t, const BoundingBox *> &b) {
+    return a.second->score > b.second->score || (a.second->score == b.second->score && a.first < b.first);
+  });
+  kept.resize(std::min(kept.size(), limits.max_output_size));
+
+  std::vector<BoundingBox> bounding_boxes_to_keep;
+  bounding_boxes_to_keep.reserve(kept.size());
+  for (auto &&k : kept) {
+    bounding_boxes_to_keep.push_back(*k.second);
+  }
+  if (kInstrumentation && counters) {
+    counters->merged_bounding_boxes += position;
+    counters->kept_bounding_boxes += bounding_boxes_to_keep.size();
+  }
+  return bounding_boxes_to_keep;
+}
+
+}
@@ -1,6 +1,13 @@
 #ifndef NMS_H_
 #define NMS_H_
 
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <vector>
 
 #include "geom.h"
@@ -9,24 +16,372 @@
 namespace nms {
 
 struct BoundingBox {
-  geom::Polygon poly;
+  BoundingBox() : score(0.0), area(0.0), axis_aligned(false) {}
+  BoundingBox(const geom::Quad &poly, float score);
+
+  // In clockwise order, see geom::clockwise.
+  geom::Quad poly;
   float score;
+
+  // Derived from poly on construction.
+  geom::AxisAlignedBox aabb;
+  float area;
+  bool axis_aligned;
+};
+
+struct MergeAccumulator {
+  // A group of merged bounding boxes as the score weighted sums of their vertices and the sum of
+  // their scores. The merged bounding box is the weighted mean of the group, it doesn't depend on
+  // the order the bounding boxes were added in and is only computed on request.
+  MergeAccumulator() : weighted_vertices(), score(0.0) {}
+  explicit MergeAccumulator(const BoundingBox &b) : MergeAccumulator() { add(b); }
+
+  void add(const BoundingBox &b);
+  BoundingBox bounding_box() const;
+
+  double weighted_vertices[8];
+  double score;
+};
+
+// Counters and stage timings are compiled out with -DLANMS_DISABLE_INSTRUMENTATION, they stay zero.
+#ifdef LANMS_DISABLE_INSTRUMENTATION
+const bool kInstrumentation = false;
+#else
+const bool kInstrumentation = true;
+#endif
+
+struct Counters {
+  Counters()
+      : iou_tests(0), prefilter_rejects(0), input_bounding_boxes(0), merged_bounding_boxes(0),
+        kept_bounding_boxes(0), sort_nanoseconds(0), merge_nanoseconds(0), suppress_nanoseconds(0) {}
+
+  // Number of pairwise overlap tests and how many of those were decided by the axis aligned
+  // bounding boxes alone, i.e. without clipping the polygons.
+  std::size_t iou_tests;
+  std::size_t prefilter_rejects;
+
+  // Number of bounding boxes passing the score threshold, left after the merging step and kept by
+  // the final standard nms step of locality aware nms.
+  std::size_t input_bounding_boxes;
+  std::size_t merged_bounding_boxes;
+  std::size_t kept_bounding_boxes;
+
+  // Time spent in the row wise sort, the merging and the standard nms step of locality aware nms.
+  // Stages that run concurrently on several bands add up the time of all bands.
+  std::size_t sort_nanoseconds;
+  std::size_t merge_nanoseconds;
+  std::size_t suppress_nanoseconds;
+
+  Counters &operator+=(const Counters &other) {
+    iou_tests += other.iou_tests;
+    prefilter_rejects += other.prefilter_rejects;
+    input_bounding_boxes += other.input_bounding_boxes;
+    merged_bounding_boxes += other.merged_bounding_boxes;
+    kept_bounding_boxes += other.kept_bounding_boxes;
+    sort_nanoseconds += other.sort_nanoseconds;
+    merge_nanoseconds += other.merge_nanoseconds;
+    suppress_nanoseconds += other.suppress_nanoseconds;
+    return *this;
+  }
+};
+
+// Storage types of the vertices of a BoundingBoxView. Vertices are converted to float when they
+// are read, all geometry is computed in float.
+enum ValueType {
+  kFloat32,
+  kFloat16,
+  kBFloat16,
+  kInt16,
+  kInt32,
+};
+
+inline std::size_t
+value_size(ValueType type) {
+  switch (type) {
+    case kFloat16:
+    case kBFloat16:
+    case kInt16:
+      return 2;
+    case kFloat32:
+    case kInt32:
+      break;
+  }
+  return 4;
+}
+
+inline float
+half_to_float(std::uint16_t bits) {
+  // IEEE 754 binary16, including subnormals, infinities and NaNs.
+  std::uint32_t sign = std::uint32_t(bits & 0x8000) << 16;
+  std::uint32_t exponent = (bits >> 10) & 0x1f;
+  std::uint32_t mantissa = bits & 0x3ff;
+  if (exponent == 0) {
+    float f = std::ldexp(float(mantissa), -24);
+    return sign ? -f : f;
+  }
+  std::uint32_t f = exponent == 0x1f ? sign | 0x7f800000 | (mantissa << 13)
+                                     : sign | ((exponent + 112) << 23) | (mantissa << 13);
+  float result;
+  std::memcpy(&result, &f, sizeof(result));
+  return result;
+}
+
+inline float
+bfloat16_to_float(std::uint16_t bits) {
+  // The upper half of a float.
+  std::uint32_t f = std::uint32_t(bits) << 16;
+  float result;
+  std::memcpy(&result, &f, sizeof(result));
+  return result;
+}
+
+inline void
+load_values(const void *data, ValueType type, float scale, std::size_t offset, std::size_t n, float *output) {
+  // Converts data[offset], ..., data[offset + n - 1] of the given type to float and multiplies
+  // them by scale.
+  switch (type) {
+    case kFloat16: {
+      auto values = static_cast<const std::uint16_t *>(data) + offset;
+      for (std::size_t k = 0; k < n; k++) {
+        output[k] = half_to_float(values[k]) * scale;
+      }
+      return;
+    }
+    case kBFloat16: {
+      auto values = static_cast<const std::uint16_t *>(data) + offset;
+      for (std::size_t k = 0; k < n; k++) {
+        output[k] = bfloat16_to_float(values[k]) * scale;
+      }
+      return;
+    }
+    case kInt16: {
+      auto values = static_cast<const std::int16_t *>(data) + offset;
+      for (std::size_t k = 0; k < n; k++) {
+        output[k] = float(values[k]) * scale;
+      }
+      return;
+    }
+    case kInt32: {
+      auto values = static_cast<const std::int32_t *>(data) + offset;
+      for (std::size_t k = 0; k < n; k++) {
+        output[k] = float(values[k]) * scale;
+      }
+      return;
+    }
+    case kFloat32:
+      break;
+  }
+  auto values = static_cast<const float *>(data) + offset;
+  for (std::size_t k = 0; k < n; k++) {
+    output[k] = values[k] * scale;
+  }
+}
+
+struct BoundingBoxView {
+  // A non-owning view of bounding boxes stored contiguously as in the input tensors of the ops,
+  // i.e. vertices of shape (size, 4, 2) and scores of shape (size,). Vertices of other types than
+  // float are converted as they are read and multiplied by vertex_scale, e.g. to undo the fixed
+  // point scale of integer vertices.
+  BoundingBoxView(const float *vertices, const float *scores, std::size_t size)
+      : vertices(vertices), scores(scores), size(size), vertex_type(kFloat32), vertex_scale(1.0) {}
+  BoundingBoxView(const void *vertices, ValueType vertex_type, float vertex_scale, const float *scores,
+                  std::size_t size)
+      : vertices(vertices), scores(scores), size(size), vertex_type(vertex_type), vertex_scale(vertex_scale) {}
+
+  const void *vertices;
+  const float *scores;
+  std::size_t size;
+  ValueType vertex_type;
+  float vertex_scale;
+
+  geom::Quad poly(std::size_t i) const {
+    float v[8];
+    load_values(vertices, vertex_type, vertex_scale, 8 * i, 8, v);
+    return geom::Quad{{v[0], v[1]}, {v[2], v[3]}, {v[4], v[5]}, {v[6], v[7]}};
+  }
+
+  BoundingBox operator[](std::size_t i) const { return BoundingBox(poly(i), scores[i]); }
+
+  // The bounding boxes begin, ..., begin + n - 1.
+  BoundingBoxView slice(std::size_t begin, std::size_t n) const {
+    return BoundingBoxView(static_cast<const char *>(vertices) + 8 * begin * value_size(vertex_type), vertex_type,
+                           vertex_scale, scores + begin, n);
+  }
+};
+
+struct IndexLists {
+  // Lists of indices in compressed sparse row format, list i consists of
+  // indices[offsets[i]], ..., indices[offsets[i + 1] - 1].
+  std::vector<std::size_t> indices;
+  std::vector<std::size_t> offsets;
+};
+
+struct Limits {
+  Limits() : score_threshold(-std::numeric_limits<float>::infinity()),
+             max_output_size(std::numeric_limits<std::size_t>::max()) {}
+
+  // Bounding boxes scored below score_threshold are dropped before any other processing and at most
+  // max_output_size bounding boxes, those with the highest scores after suppression, are returned.
+  float score_threshold;
+  std::size_t max_output_size;
 };
 
+class Workspace {
+  // Scratch memory of the nms functions kept between calls: sort keys, bands, candidates, the spatial
+  // grid and suppression state. Buffers are cleared but never freed, i.e. a workspace holds on to the
+  // memory needed by the largest input seen so far. Repeated calls on inputs of similar size then only
+  // allocate the vectors of bounding boxes and indices they return or pass from merging to
+  // suppression, and the windowed merge the index lists of its open merged bounding boxes if
+  // contributing indices are requested. The class aware and tiled functions keep one
+  // workspace per concurrently processed class or tile within it, but allocate the partition into
+  // classes or tiles and their results on every call. A workspace must not be used by concurrent
+  // calls, e.g. keep one per thread or a pool of them.
+ public:
+  struct Buffers;
+
+  Workspace();
+  ~Workspace();
+
+  Buffers &buffers() { return *buffers_; }
+
+ private:
+  std::unique_ptr<Buffers> buffers_;
+};
+
+enum SoftNMSMethod {
+  kSoftNMSLinear = 0,
+  kSoftNMSGaussian = 1,
+};
+
+// Calls fn(i) for each i in [0, n), possibly concurrently, and returns when all calls are done.
+typedef std::function<void(std::size_t n, const std::function<void(std::size_t i)> &fn)> ParallelFor;
+
+// Calls fn, e.g. within a profiler span of the stage called name. Stages may be traced concurrently.
+typedef std::function<void(const char *name, const std::function<void()> &fn)> Trace;
+
 float
 min_y(const BoundingBox &b);
 
 bool
-should_merge(const BoundingBox &a, const BoundingBox &b, float iou_threshold);
+should_merge(const BoundingBox &a, const BoundingBox &b, float iou_threshold, Counters *counters = nullptr);
 
 BoundingBox
 weighted_merge(const BoundingBox &a, const BoundingBox &b);
 
 std::vector<BoundingBox>
-standard_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold);
+standard_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, Counters *counters = nullptr,
+             const Limits &limits = Limits(), Workspace *workspace = nullptr);
+
+std::vector<std::size_t>
+standard_nms_indices(const BoundingBoxView &bounding_boxes, float iou_threshold, Counters *counters = nullptr,
+                     const Limits &limits = Limits(), Workspace *workspace = nullptr);
+
+// Soft-NMS (https://arxiv.org/abs/1704.04503): the scores of bounding boxes overlapping a kept
+// bounding box are decayed instead of suppressing them, by 1 - iou if iou >= iou_threshold (linear)
+// or by exp(-iou^2 / sigma) (gaussian). Bounding boxes whose score falls below limits.score_threshold
+// are dropped. The kept bounding boxes are returned with their decayed scores, ordered by them.
+std::vector<BoundingBox>
+soft_nms(const std::vector<BoundingBox> &bounding_boxes, SoftNMSMethod method, float iou_threshold, float sigma,
+         Counters *counters = nullptr, const Limits &limits = Limits(), Workspace *workspace = nullptr);
+
+// Same as soft_nms, the decayed scores of the kept bounding boxes are written to scores.
+std::vector<std::size_t>
+soft_nms_indices(const BoundingBoxView &bounding_boxes, SoftNMSMethod method, float iou_threshold, float sigma,
+                 std::vector<float> *scores, Counters *counters = nullptr, const Limits &limits = Limits(),
+                 Workspace *workspace = nullptr);
+
+// If contributing_indices is given, list i holds the indices of the input bounding boxes that were
+// merged into output bounding box i.
+std::vector<BoundingBox>
+locality_aware_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, Counters *counters = nullptr,
+                   IndexLists *contributing_indices = nullptr);
+
+std::vector<BoundingBox>
+locality_aware_nms(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, std::size_t num_bands,
+                   const ParallelFor &parallel_for, Counters *counters = nullptr,
+                   IndexLists *contributing_indices = nullptr);
+
+std::vector<BoundingBox>
+locality_aware_nms(const BoundingBoxView &bounding_boxes, float iou_threshold, Counters *counters = nullptr,
+                   IndexLists *contributing_indices = nullptr, const Limits &limits = Limits());
+
+std::vector<BoundingBox>
+locality_aware_nms(const BoundingBoxView &bounding_boxes, float iou_threshold, std::size_t num_bands,
+                   const ParallelFor &parallel_for, Counters *counters = nullptr,
+                   IndexLists *contributing_indices = nullptr, const Limits &limits = Limits());
+
+// Same as locality_aware_nms, but up to window merged bounding boxes are kept open at a time such that
+// interleaved runs of bounding boxes on the same rows can be merged, which leaves fewer bounding boxes
+// for the quadratic standard nms step. Not parallelized, a window of size one is equivalent to
+// locality_aware_nms.
+std::vector<BoundingBox>
+locality_aware_nms_windowed(const std::vector<BoundingBox> &bounding_boxes, float iou_threshold, std::size_t window,
+                            Counters *counters = nullptr, IndexLists *contributing_indices = nullptr,
+                            Workspace *workspace = nullptr);
+
+std::vector<BoundingBox>
+locality_aware_nms_windowed(const BoundingBoxView &bounding_boxes, float iou_threshold, std::size_t window,
+                            Counters *counters = nullptr, IndexLists *contributing_indices = nullptr,
+                            const Limits &limits = Limits(), Workspace *workspace = nullptr);
+
+// The merging and the standard nms step of locality aware nms on their own, e.g. to trace them
+// separately. Windows larger than one merge as locality_aware_nms_windowed, otherwise num_bands bands
+// are merged concurrently. If merged_indices is given, list i holds the indices of the input bounding
+// boxes merged into merged bounding box i, suppress_merged needs them for contributing_indices. If
+// given, the row wise sort of each band, or of the window, is run within the stage "sort" of trace.
+std::vector<BoundingBox>
+locality_aware_merge(const BoundingBoxView &bounding_boxes, float iou_threshold, std::size_t num_bands,
+                     const ParallelFor *parallel_for = nullptr, std::size_t window = 1, Counters *counters = nullptr,
+                     IndexLists *merged_indices = nullptr, const Limits &limits = Limits(),
+                     Workspace *workspace = nullptr, const Trace *trace = nullptr);
+
+std::vector<BoundingBox>
+suppress_merged(const std::vector<BoundingBox> &merged_bounding_boxes, const IndexLists &merged_indices,
+                float iou_threshold, Counters *counters = nullptr, IndexLists *contributing_indices = nullptr,
+                const Limits &limits = Limits(), Workspace *workspace = nullptr);
+
+// Class aware variants of standard_nms_indices and locality_aware_nms: bounding box i belongs to
+// class class_ids[i] and only suppresses or is merged with bounding boxes of the same class. Classes
+// are processed concurrently if parallel_for is given. The outputs of all classes are ordered by
+// descending scores and limited to limits.max_output_size in total. If given, output_class_ids
+// holds the class of each output bounding box.
+std::vector<std::size_t>
+class_aware_standard_nms_indices(const BoundingBoxView &bounding_boxes, const int *class_ids, float iou_threshold,
+                                 const ParallelFor *parallel_for = nullptr, Counters *counters = nullptr,
+                                 const Limits &limits = Limits(), Workspace *workspace = nullptr);
+
+std::vector<BoundingBox>
+class_aware_locality_aware_nms(const BoundingBoxView &bounding_boxes, const int *class_ids, float iou_threshold,
+                               const ParallelFor *parallel_for = nullptr, Counters *counters = nullptr,
+                               IndexLists *contributing_indices = nullptr, std::vector<int> *output_class_ids = nullptr,
+                               const Limits &limits = Limits(), Workspace *workspace = nullptr);
+
+struct TileLayout {
+  // Tiles of an image processed separately, e.g. by a detector run on a large scan. Tile t covers
+  // the rectangle from (offsets[2 * t], offsets[2 * t + 1]) to (offsets[2 * t] + width,
+  // offsets[2 * t + 1] + height) of the image, its bounding boxes are relative to its top left.
+  const float *offsets;
+  std::size_t size;
+  float width;
+  float height;
+
+  // Bounding boxes of a tile further than margin from its border must not overlap bounding boxes of
+  // other tiles, i.e. margin must be at least the overlap of adjacent tiles plus how far bounding
+  // boxes may extend beyond their tile.
+  float margin;
+};
 
+// Locality aware nms of the bounding boxes of a tiled image, bounding box i belongs to tile
+// tile_ids[i] in [0, tiles.size). The bounding boxes of each tile are merged on their own, without
+// sorting the whole image, and suppressed within the tile if they can't interact with other tiles.
+// Only the merged bounding boxes near tile borders, and those of their tile they could suppress
+// transitively, are suppressed in a seam pass across tiles. Tiles are processed concurrently if
+// parallel_for is given. The result is identical to suppress_merged over the merged bounding boxes
+// of all tiles in image coordinates, in order of tile ids.
 std::vector<BoundingBox>
-locality_aware_nms(std::vector<BoundingBox> &bounding_boxes, float iou_threshold);
+tiled_locality_aware_nms(const BoundingBoxView &bounding_boxes, const int *tile_ids, const TileLayout &tiles,
+                         float iou_threshold, const ParallelFor *parallel_for = nullptr, Counters *counters = nullptr,
+                         const Limits &limits = Limits(), Workspace *workspace = nullptr);
 
 }
 
@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "geom.h"
+#include "nms.h"
+
+
+/*
+Benchmarks of the geometry and NMS kernels on synthetic EAST-like outputs.
+
+  bazel run -c opt //lanms:nms_benchmark -- --benchmark_out=results.json --benchmark_out_format=json
+
+Besides the time per iteration each benchmark reports the number of processed boxes per second,
+the time per box and the number of heap allocations per iteration. Two such result files can be
+compared with compare_benchmarks.py.
+*/
+
+// Heap allocations are counted by replacing all global allocation functions, such that every
+// new expression, including the nothrow, array and over-aligned forms, is counted and freed by the
+// matching delete. Allocations made directly through malloc are not counted.
+static std::atomic<std::size_t> num_allocations(0);
+
+static void *
+_allocate(std::size_t size) noexcept {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size ? size : 1);
+}
+
+static void *
+_allocate_or_throw(std::size_t size) {
+  if (void *p = _allocate(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size) { return _allocate_or_throw(size); }
+void *operator new[](std::size_t size) { return _allocate_or_throw(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return _allocate(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return _allocate(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+
+#ifdef __cpp_aligned_new
+static void *
+_allocate_aligned(std::size_t size, std::align_val_t alignment) noexcept {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = nullptr;
+  auto a = std::max(static_cast<std::size_t>(alignment), sizeof(void *));
+  return posix_memalign(&p, a, size ? size : 1) == 0 ? p : nullptr;
+}
+
+static void *
+_allocate_aligned_or_throw(std::size_t size, std::align_val_t alignment) {
+  if (void *p = _allocate_aligned(size, alignment)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t a) { return _allocate_aligned_or_throw(size, a); }
+void *operator new[](std::size_t size, std::align_val_t a) { return _allocate_aligned_or_throw(size, a); }
+void *operator new(std::size_t size, std::align_val_t a, const std::nothrow_t &) noexcept {
+  return _allocate_aligned(size, a);
+}
+void *operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t &) noexcept {
+  return _allocate_aligned(size, a);
+}
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+#endif
+
+static void
+_set_counters(benchmark::State &state, std::size_t num_boxes, std::size_t allocations_before) {
+  auto allocations = num_allocations.load() - allocations_before;
+  state.counters["boxes"] = benchmark::Counter(num_boxes, benchmark::Counter::kIsIterationInvariantRate);
+  state.counters["per_box"] = benchmark::Counter(
+      num_boxes, benchmark::Counter::kIsIterationInvariantRate | benchmark::Counter::kInvert);
+  state.counters["allocs"] = benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+}
+
+static void
+_threads(std::size_t n, const std::function<void(std::size_t)> &fn) {
+  // A nms::ParallelFor with one worker per hardware thread, each taking the next item until all are
+  // done.
+  std::atomic<std::size_t> next(0);
+  auto work = [&]() {
+    for (auto i = next++; i < n; i = next++) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (std::size_t k = 1; k < std::min(std::size_t(std::thread::hardware_concurrency()), n); k++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto &&w : workers) {
+    w.join();
+  }
+}
+
+static geom::Quad
+_rotated_rectangle(float cx, float cy, float w, float h, float angle) {
+  float c = std::cos(angle);
+  float s = std::sin(angle);
+  geom::Quad q;
+  const float corners[4][2] = {{-0.5f, -0.5f}, {0.5f, -0.5f}, {0.5f, 0.5f}, {-0.5f, 0.5f}};
+  for (std::size_t k = 0; k < 4; k++) {
+    float x = corners[k][0] * w;
+    float y = corners[k][1] * h;
+    q[k] = geom::Point{cx + c * x - s * y, cy + s * x + c * y};
+  }
+  return q;
+}
+
+static std::vector<nms::BoundingBox>
+_text_lines(std::size_t n, std::size_t boxes_per_line, float max_angle, unsigned seed = 0) {
+  // Dense text lines as predicted by EAST: every text line is covered by boxes_per_line slightly
+  // jittered predictions of roughly the same rotated rectangle. Higher boxes_per_line means a
+  // higher overlap density. With a max_angle of zero all boxes are axis aligned rectangles.
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::normal_distribution<float> jitter(0.0f, 1.5f);
+
+  // Lay out the lines on a square image such that they hardly overlap.
+  auto num_lines = std::max(std::size_t(1), n / boxes_per_line);
+  auto lines_per_row = std::max(std::size_t(1), std::size_t(std::sqrt(num_lines / 4.0)));
+  std::vector<nms::BoundingBox> bounding_boxes;
+  bounding_boxes.reserve(n);
+  for (std::size_t i = 0; i < n; i++) {
+    auto line = i / boxes_per_line;
+    float cx = 220.0f * (line % lines_per_row) + 100.0f;
+    float cy = 40.0f * (line / lines_per_row) + 20.0f;
+    float angle = max_angle * (2.0f * std::fmod(line * 0.6180339f, 1.0f) - 1.0f);
+    auto q = _rotated_rectangle(cx + jitter(rng), cy + jitter(rng), 160.0f + jitter(rng), 24.0f + jitter(rng),
+                                max_angle > 0.0f ? angle + 0.01f * jitter(rng) : 0.0f);
+    bounding_boxes.push_back(nms::BoundingBox(q, 0.5f + 0.5f * unit(rng)));
+  }
+  return bounding_boxes;
+}
+
+static std::vector<nms::BoundingBox>
+_random_quads(std::size_t n, unsigned seed = 0) {
+  // Uniformly scattered rotated rectangles of varying size, i.e. little locality.
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  float extent = 100.0f * std::sqrt(float(n));
+  std::vector<nms::BoundingBox> bounding_boxes;
+  bounding_boxes.reserve(n);
+  for (std::size_t i = 0; i < n; i++) {
+    auto q = _rotated_rectangle(extent * unit(rng), extent * unit(rng), 20.0f + 180.0f * unit(rng),
+                                10.0f + 40.0f * unit(rng), 3.1415926f * unit(rng));
+    bounding_boxes.push_back(nms::BoundingBox(q, unit(rng)));
+  }
+  return bounding_boxes;
+}
+
+static std::vector<nms::BoundingBox>
+_generate(const benchmark::State &state) {
+  // range(0): number of boxes, range(1): boxes per text line or 0 for random quads.
+  auto n = std::size_t(state.range(0));
+  auto boxes_per_line = std::size_t(state.range(1));
+  return boxes_per_line ? _text_lines(n, boxes_per_line, 0.3f) : _random_quads(n);
+}
+
+static void
+_nms_args(benchmark::internal::Benchmark *b) {
+  for (long n : {1000, 10000, 50000, 200000}) {
+    for (long boxes_per_line : {0, 4, 32}) {
+      b->Args({n, boxes_per_line});
+    }
+  }
+  b->ArgNames({"n", "per_line"})->Unit(benchmark::kMillisecond);
+}
+
+static void
+BM_IntersectionOverUnion(benchmark::State &state) {
+  auto bounding_boxes = _text_lines(1024, 8, 0.3f);
+  std::size_t i = 0;
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    const auto &a = bounding_boxes[i % bounding_boxes.size()];
+    const auto &b = bounding_boxes[(i + 1) % bounding_boxes.size()];
+    benchmark::DoNotOptimize(geom::intersection_over_union(a.poly, b.poly));
+    i++;
+  }
+  _set_counters(state, 1, allocations_before);
+}
+
+BENCHMARK(BM_IntersectionOverUnion);
+
+static void
+BM_IntersectionOverUnionBatch(benchmark::State &state) {
+  // One-vs-many overlap of a box with its neighbours, range(0) is the simd level, range(1) whether
+  // the boxes are axis aligned rectangles.
+  auto bounding_boxes = _text_lines(4096, 8, state.range(1) ? 0.0f : 0.3f);
+  geom::QuadBatch batch;
+  for (auto &&b : bounding_boxes) {
+    batch.push_back(b.poly);
+  }
+  std::vector<float> ious(batch.size());
+  auto level = geom::SimdLevel(std::min<long>(state.range(0), geom::supported_simd_level()));
+  std::size_t i = 0;
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    geom::intersection_over_union(bounding_boxes[i % bounding_boxes.size()].poly, batch, 0, batch.size(),
+                                  ious.data(), level);
+    benchmark::DoNotOptimize(ious.data());
+    i++;
+  }
+  _set_counters(state, batch.size(), allocations_before);
+}
+
+BENCHMARK(BM_IntersectionOverUnionBatch)
+    ->ArgsProduct({{geom::kSimdScalar, geom::kSimdSSE, geom::kSimdAVX2}, {0, 1}})
+    ->ArgNames({"simd", "axis_aligned"});
+
+static void
+BM_StandardNMS(benchmark::State &state) {
+  auto bounding_boxes = _generate(state);
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(nms::standard_nms(bounding_boxes, 0.3f));
+  }
+  _set_counters(state, bounding_boxes.size(), allocations_before);
+}
+
+BENCHMARK(BM_StandardNMS)->Apply(_nms_args);
+
+static void
+BM_SoftNMS(benchmark::State &state) {
+  auto bounding_boxes = _generate(state);
+  nms::Limits limits;
+  limits.score_threshold = 0.001f;
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(nms::soft_nms(bounding_boxes, nms::kSoftNMSGaussian, 0.3f, 0.5f, nullptr, limits));
+  }
+  _set_counters(state, bounding_boxes.size(), allocations_before);
+}
+
+BENCHMARK(BM_SoftNMS)->Apply(_nms_args);
+
+static void
+BM_LocalityAwareNMS(benchmark::State &state) {
+  auto bounding_boxes = _generate(state);
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(nms::locality_aware_nms(bounding_boxes, 0.3f));
+  }
+  _set_counters(state, bounding_boxes.size(), allocations_before);
+}
+
+BENCHMARK(BM_LocalityAwareNMS)->Apply(_nms_args);
+
+static void
+BM_LocalityAwareNMSWindowed(benchmark::State &state) {
+  // range(2): merge window. Reports the merged bounding boxes handed to standard NMS per input box.
+  auto bounding_boxes = _generate(state);
+  auto window = std::size_t(state.range(2));
+  nms::Counters counters;
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(nms::locality_aware_nms_windowed(bounding_boxes, 0.3f, window, &counters));
+  }
+  _set_counters(state, bounding_boxes.size(), allocations_before);
+  state.counters["merged"] = benchmark::Counter(
+      double(counters.merged_bounding_boxes) / bounding_boxes.size(), benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(BM_LocalityAwareNMSWindowed)
+    ->ArgsProduct({{10000, 50000}, {4, 32}, {1, 4, 16}})
+    ->ArgNames({"n", "per_line", "window"})
+    ->Unit(benchmark::kMillisecond);
+
+static void
+BM_LocalityAwareNMSParallel(benchmark::State &state) {
+  // Same as above with one band per hardware thread.
+  auto bounding_boxes = _generate(state);
+  auto num_bands = std::max(1u, std::thread::hardware_concurrency());
+  nms::ParallelFor threads = _threads;
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(nms::locality_aware_nms(bounding_boxes, 0.3f, num_bands, threads));
+  }
+  _set_counters(state, bounding_boxes.size(), allocations_before);
+}
+
+BENCHMARK(BM_LocalityAwareNMSParallel)->Apply(_nms_args)->UseRealTime();
+
+static void
+BM_LocalityAwareNMSWorkspace(benchmark::State &state) {
+  // The two steps of locality aware nms on contiguous buffers as in the ops, range(2) whether the
+  // scratch memory is reused across iterations.
+  auto bounding_boxes = _generate(state);
+  std::vector<float> vertices, scores;
+  for (auto &&b : bounding_boxes) {
+    for (auto &&p : b.poly) {
+      vertices.push_back(p.x);
+      vertices.push_back(p.y);
+    }
+    scores.push_back(b.score);
+  }
+  nms::BoundingBoxView view{vertices.data(), scores.data(), bounding_boxes.size()};
+  nms::Workspace workspace;
+  auto reuse = state.range(2) != 0;
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    nms::IndexLists merged_indices;
+    auto merged = nms::locality_aware_merge(view, 0.3f, 1, nullptr, 1, nullptr, nullptr, nms::Limits(),
+                                            reuse ? &workspace : nullptr);
+    benchmark::DoNotOptimize(nms::suppress_merged(merged, merged_indices, 0.3f, nullptr, nullptr, nms::Limits(),
+                                                  reuse ? &workspace : nullptr));
+  }
+  _set_counters(state, bounding_boxes.size(), allocations_before);
+}
+
+BENCHMARK(BM_LocalityAwareNMSWorkspace)
+    ->ArgsProduct({{10000, 50000}, {0, 4}, {0, 1}})
+    ->ArgNames({"n", "per_line", "reuse"})
+    ->Unit(benchmark::kMillisecond);
+
+static void
+BM_TiledLocalityAwareNMS(benchmark::State &state) {
+  // The image is cut into tiles of 1024 x 1024 pixels, each box belongs to the tile of its center.
+  // range(2) whether the tiles are processed by tiled_locality_aware_nms, one thread per tile, or
+  // the whole image by locality_aware_nms.
+  auto bounding_boxes = _generate(state);
+  const float tile_size = 1024.0f;
+  std::vector<float> vertices, scores, tile_offsets;
+  std::vector<float> image_vertices;
+  std::vector<int> tile_ids;
+  float margin = 0.0f;
+  std::size_t tiles_per_row = 1;
+  for (auto &&b : bounding_boxes) {
+    tiles_per_row = std::max(tiles_per_row, std::size_t(b.aabb.max_x / tile_size) + 1);
+  }
+  for (auto &&b : bounding_boxes) {
+    auto tx = std::size_t(std::max(0.0f, 0.5f * (b.aabb.min_x + b.aabb.max_x)) / tile_size);
+    auto ty = std::size_t(std::max(0.0f, 0.5f * (b.aabb.min_y + b.aabb.max_y)) / tile_size);
+    auto t = ty * tiles_per_row + tx;
+    float x = tx * tile_size, y = ty * tile_size;
+    margin = std::max({margin, x - b.aabb.min_x, y - b.aabb.min_y, b.aabb.max_x - x - tile_size,
+                       b.aabb.max_y - y - tile_size});
+    for (auto &&p : b.poly) {
+      vertices.push_back(p.x - x);
+      vertices.push_back(p.y - y);
+      image_vertices.push_back(p.x);
+      image_vertices.push_back(p.y);
+    }
+    scores.push_back(b.score);
+    tile_ids.push_back(t);
+    tile_offsets.resize(std::max(tile_offsets.size(), 2 * t + 2));
+    tile_offsets[2 * t] = x;
+    tile_offsets[2 * t + 1] = y;
+  }
+  nms::BoundingBoxView view{vertices.data(), scores.data(), bounding_boxes.size()};
+  nms::BoundingBoxView image_view{image_vertices.data(), scores.data(), bounding_boxes.size()};
+  nms::TileLayout tiles{tile_offsets.data(), tile_offsets.size() / 2, tile_size, tile_size, margin};
+  nms::ParallelFor threads = _threads;
+  auto tiled = state.range(2) != 0;
+  auto allocations_before = num_allocations.load();
+  for (auto _ : state) {
+    if (tiled) {
+      benchmark::DoNotOptimize(nms::tiled_locality_aware_nms(view, tile_ids.data(), tiles, 0.3f, &threads));
+    } else {
+      benchmark::DoNotOptimize(nms::locality_aware_nms(image_view, 0.3f));
+    }
+  }
+  _set_counters(state, bounding_boxes.size(), allocations_before);
+}
+
+BENCHMARK(BM_TiledLocalityAwareNMS)
+    ->ArgsProduct({{50000, 200000}, {0, 4}, {0, 1}})
+    ->ArgNames({"n", "per_line", "tiled"})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
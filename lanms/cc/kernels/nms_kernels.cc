@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/profiler/lib/traceme.h"
+#include "tensorflow/core/util/work_sharder.h"
 
+#include "geometry_map.h"
 #include "nms.h"
 
 using namespace tensorflow;
@@ -27,84 +37,746 @@ _check_input_bounding_boxes(OpKernelContext* context, const Tensor &vertices, co
 }
 
 float
-_get_input_iou_threshold(OpKernelContext* context) {
-  const float iou_threshold = context->input(2).scalar<float>()();
+_get_input_iou_threshold(OpKernelContext* context, int index = 2) {
+  const float iou_threshold = context->input(index).scalar<float>()();
   _check_input_iou_threshold(context, iou_threshold);
   return iou_threshold;
 }
 
-std::vector<nms::BoundingBox>
-_get_input_bounding_boxes(OpKernelContext* context) {
+static const void *
+_get_vertices_data(const Tensor &vertices, nms::ValueType *type) {
+  // The op registrations restrict vertices to these types.
+  switch (vertices.dtype()) {
+    case DT_HALF:
+      *type = nms::kFloat16;
+      return vertices.flat<Eigen::half>().data();
+    case DT_BFLOAT16:
+      *type = nms::kBFloat16;
+      return vertices.flat<bfloat16>().data();
+    case DT_INT16:
+      *type = nms::kInt16;
+      return vertices.flat<int16>().data();
+    case DT_INT32:
+      *type = nms::kInt32;
+      return vertices.flat<int32>().data();
+    default:
+      *type = nms::kFloat32;
+      return vertices.flat<float>().data();
+  }
+}
+
+nms::BoundingBoxView
+_get_input_bounding_boxes(OpKernelContext* context, float vertex_scale) {
+  // Returns a view of the input tensors, the bounding boxes are not copied. Vertices of other types
+  // than float are converted as they are read.
   const Tensor& vertices = context->input(0);
   const Tensor& probs = context->input(1);
   _check_input_bounding_boxes(context, vertices, probs);
-
-  std::vector<nms::BoundingBox> bounding_boxes;
-  auto n = vertices.shape().dim_size(0);
-  auto vertices_data = vertices.tensor<float, 3>();
-  auto probs_data = probs.tensor<float, 2>();
-  for (std::size_t i = 0; i < n; i++) {
-    bounding_boxes.push_back(nms::BoundingBox{
-      {{vertices_data(i, 0, 0), vertices_data(i, 0, 1)},
-       {vertices_data(i, 1, 0), vertices_data(i, 1, 1)},
-       {vertices_data(i, 2, 0), vertices_data(i, 2, 1)},
-       {vertices_data(i, 3, 0), vertices_data(i, 3, 1)}},
-      probs_data(i, 0)
-    });
+  if (!context->status().ok()) {
+    return nms::BoundingBoxView{nullptr, nullptr, 0};
   }
 
-  return bounding_boxes;
+  nms::ValueType vertex_type;
+  const void *vertices_data = _get_vertices_data(vertices, &vertex_type);
+  return nms::BoundingBoxView{
+    vertices_data, vertex_type, vertex_scale, probs.flat<float>().data(), std::size_t(vertices.dim_size(0))};
 }
 
-void
-_populate_output_tensors(OpKernelContext* context, const std::vector<nms::BoundingBox> &bounding_boxes) {
+static void
+_allocate_output_tensors(OpKernelContext* context, std::size_t n, float **vertices_data, float **scores_data) {
   // Allocate output tensor for vertices.
   Tensor* vertices_output = NULL;
-  TensorShape vertices_output_shape({int(bounding_boxes.size()), 4, 2});
+  TensorShape vertices_output_shape({int64(n), 4, 2});
   OP_REQUIRES_OK(context, context->allocate_output(0, vertices_output_shape, &vertices_output));
 
   // Allocate output tensor for scores.
   Tensor* scores_output = NULL;
-  TensorShape scores_output_shape({int(bounding_boxes.size())});
+  TensorShape scores_output_shape({int64(n)});
   OP_REQUIRES_OK(context, context->allocate_output(1, scores_output_shape, &scores_output));
 
-  // Copy data into output tensors.
-  auto vertices_output_data = vertices_output->tensor<float, 3>();
-  auto scores_output_data = scores_output->tensor<float, 1>();
+  *vertices_data = vertices_output->flat<float>().data();
+  *scores_data = scores_output->flat<float>().data();
+}
+
+static inline void
+_write_bounding_box(const geom::Quad &poly, float score, float *vertices_data, float *scores_data) {
+  for (std::size_t j = 0; j < 4; j++) {
+    vertices_data[2 * j] = poly[j].x;
+    vertices_data[2 * j + 1] = poly[j].y;
+  }
+  *scores_data = score;
+}
+
+static inline void
+_write_bounding_box(const nms::BoundingBox &bounding_box, float *vertices_data, float *scores_data) {
+  _write_bounding_box(bounding_box.poly, bounding_box.score, vertices_data, scores_data);
+}
+
+void
+_populate_output_tensors(OpKernelContext* context, const std::vector<nms::BoundingBox> &bounding_boxes) {
+  float *vertices_data = nullptr;
+  float *scores_data = nullptr;
+  _allocate_output_tensors(context, bounding_boxes.size(), &vertices_data, &scores_data);
+  if (!context->status().ok()) {
+    return;
+  }
+
   for (std::size_t i = 0; i < bounding_boxes.size(); i++) {
-    for (std::size_t j = 0; j < 4; j++) {
-      vertices_output_data(i, j, 0) = bounding_boxes[i].poly[j].x;
-      vertices_output_data(i, j, 1) = bounding_boxes[i].poly[j].y;
-    }
+    _write_bounding_box(bounding_boxes[i], vertices_data + 8 * i, scores_data + i);
+  }
+}
+
+void
+_populate_output_tensors(OpKernelContext* context, const nms::BoundingBoxView &bounding_boxes,
+                         const std::vector<std::size_t> &indices, const float *scores = nullptr) {
+  // Copies the selected bounding boxes from the input to the output tensors, converted to float and
+  // in clockwise order as the outputs of all other ops. If given, scores[i] replaces the score of
+  // bounding box indices[i].
+  float *vertices_data = nullptr;
+  float *scores_data = nullptr;
+  _allocate_output_tensors(context, indices.size(), &vertices_data, &scores_data);
+  if (!context->status().ok()) {
+    return;
+  }
+
+  for (std::size_t i = 0; i < indices.size(); i++) {
+    _write_bounding_box(geom::clockwise(bounding_boxes.poly(indices[i])),
+                        scores ? scores[i] : bounding_boxes.scores[indices[i]], vertices_data + 8 * i, scores_data + i);
+  }
+}
+
+static void
+_populate_output_indices(OpKernelContext* context, int index, const std::vector<std::size_t> &indices) {
+  Tensor* indices_output = NULL;
+  TensorShape indices_output_shape({int64(indices.size())});
+  OP_REQUIRES_OK(context, context->allocate_output(index, indices_output_shape, &indices_output));
+  std::copy(indices.begin(), indices.end(), indices_output->flat<int32>().data());
+}
+
+static void
+_populate_output_class_ids(OpKernelContext* context, int index, const std::vector<int> &class_ids) {
+  Tensor* class_ids_output = NULL;
+  TensorShape class_ids_output_shape({int64(class_ids.size())});
+  OP_REQUIRES_OK(context, context->allocate_output(index, class_ids_output_shape, &class_ids_output));
+  std::copy(class_ids.begin(), class_ids.end(), class_ids_output->flat<int32>().data());
+}
+
+static inline void
+_check_input_class_ids(OpKernelContext* context, const Tensor &class_ids, std::size_t num_bounding_boxes) {
+  OP_REQUIRES(context, class_ids.dims() == 1 && std::size_t(class_ids.dim_size(0)) == num_bounding_boxes,
+      errors::InvalidArgument("class_ids must be shape (?,) matching vertices", class_ids.shape().DebugString()));
+}
+
+static const int *
+_get_input_class_ids(OpKernelContext* context, const nms::BoundingBoxView &bounding_boxes) {
+  const Tensor& class_ids = context->input(2);
+  _check_input_class_ids(context, class_ids, bounding_boxes.size);
+  return context->status().ok() ? class_ids.flat<int32>().data() : nullptr;
+}
+
+static void
+_check_input_tile_ids(OpKernelContext* context, const Tensor &tile_ids, const Tensor &tile_offsets,
+                      std::size_t num_bounding_boxes) {
+  OP_REQUIRES(context, tile_ids.dims() == 1 && std::size_t(tile_ids.dim_size(0)) == num_bounding_boxes,
+      errors::InvalidArgument("tile_ids must be shape (?,) matching vertices", tile_ids.shape().DebugString()));
+  OP_REQUIRES(context, tile_offsets.dims() == 2 && tile_offsets.dim_size(1) == 2,
+      errors::InvalidArgument("tile_offsets must be shape (num_tiles, 2)", tile_offsets.shape().DebugString()));
+  auto tile_ids_data = tile_ids.flat<int32>();
+  for (int64 i = 0; i < tile_ids.dim_size(0); i++) {
+    OP_REQUIRES(context, tile_ids_data(i) >= 0 && tile_ids_data(i) < tile_offsets.dim_size(0),
+        errors::InvalidArgument("tile_ids must be in [0, num_tiles)"));
+  }
+}
+
+static const int *
+_get_input_tile_ids(OpKernelContext* context, const nms::BoundingBoxView &bounding_boxes,
+                    const Tensor &tile_offsets) {
+  const Tensor& tile_ids = context->input(2);
+  _check_input_tile_ids(context, tile_ids, tile_offsets, bounding_boxes.size);
+  return context->status().ok() ? tile_ids.flat<int32>().data() : nullptr;
+}
+
+static void
+_get_attr_limits(OpKernelConstruction* context, nms::Limits *limits) {
+  int max_output_size;
+  OP_REQUIRES_OK(context, context->GetAttr("score_threshold", &limits->score_threshold));
+  OP_REQUIRES_OK(context, context->GetAttr("max_output_size", &max_output_size));
+  if (max_output_size >= 0) {
+    limits->max_output_size = max_output_size;
+  }
+}
+
+void
+_log_counters(const char *op_name, const nms::Counters &counters) {
+  VLOG(1) << op_name << ": " << counters.iou_tests << " iou tests, "
+          << counters.prefilter_rejects << " rejected by axis aligned bounding boxes ("
+          << (counters.iou_tests ? 100.0 * counters.prefilter_rejects / counters.iou_tests : 0.0) << "%), "
+          << counters.merged_bounding_boxes << " merged bounding boxes";
+}
 
-    scores_output_data(i) = bounding_boxes[i].score;
+static void
+_populate_output_stats(OpKernelContext* context, int index, const nms::Counters &counters, bool return_stats) {
+  // The layout of the stats is documented with the LocalityAwareNMS op.
+  std::vector<int64> stats;
+  if (return_stats && nms::kInstrumentation) {
+    stats = {int64(counters.input_bounding_boxes), int64(counters.merged_bounding_boxes),
+             int64(counters.kept_bounding_boxes), int64(counters.iou_tests), int64(counters.prefilter_rejects),
+             int64(counters.sort_nanoseconds), int64(counters.merge_nanoseconds),
+             int64(counters.suppress_nanoseconds)};
   }
+  Tensor* stats_output = NULL;
+  TensorShape stats_output_shape({int64(stats.size())});
+  OP_REQUIRES_OK(context, context->allocate_output(index, stats_output_shape, &stats_output));
+  std::copy(stats.begin(), stats.end(), stats_output->flat<int64>().data());
+}
+
+// Inputs smaller than this are processed on a single thread.
+static const std::size_t kMinBoundingBoxesPerBand = 4096;
+
+static std::size_t
+_get_num_bands(OpKernelContext* context, std::size_t num_bounding_boxes) {
+  auto num_threads = context->device()->tensorflow_cpu_worker_threads()->num_threads;
+  return std::max(std::size_t(1), std::min(std::size_t(num_threads), num_bounding_boxes / kMinBoundingBoxesPerBand));
+}
+
+static nms::ParallelFor
+_get_parallel_for(OpKernelContext* context) {
+  // Runs the work items on the intra op thread pool.
+  auto worker_threads = context->device()->tensorflow_cpu_worker_threads();
+  return [worker_threads](std::size_t n, const std::function<void(std::size_t)> &fn) {
+    // Each work item is a whole band, make sure they are all scheduled separately.
+    const int64 cost_per_unit = 1 << 30;
+    Shard(worker_threads->num_threads, worker_threads->workers, n, cost_per_unit, [&fn](int64 begin, int64 end) {
+      for (auto i = begin; i < end; i++) {
+        fn(i);
+      }
+    });
+  };
 }
 
+static void
+_trace_locality_aware_nms(const char *stage, const std::function<void()> &fn) {
+  // Traces the stages run within the merge, e.g. the sort of each band, as spans of their own.
+  profiler::TraceMe trace(std::string("LocalityAwareNMS:") + stage);
+  fn();
+}
+
+struct _Scratch {
+  // Scratch memory of a Compute call that is reused by later calls of the same kernel, such that
+  // serving similar inputs doesn't allocate and free the same buffers over and over.
+  nms::Workspace workspace;
+  nms::IndexLists merged_indices;
+  nms::IndexLists contributing_indices;
+  std::vector<float> scores;
+};
+
+class _ScratchPool {
+  // Hands out one scratch per concurrent Compute call, released scratch is kept for later calls.
+  // The pool grows to the number of concurrent calls, each scratch to the largest input it saw.
+ public:
+  std::unique_ptr<_Scratch> acquire() {
+    mutex_lock lock(mu_);
+    if (free_.empty()) {
+      return std::unique_ptr<_Scratch>(new _Scratch());
+    }
+    auto scratch = std::move(free_.back());
+    free_.pop_back();
+    return scratch;
+  }
+
+  void release(std::unique_ptr<_Scratch> scratch) {
+    mutex_lock lock(mu_);
+    free_.push_back(std::move(scratch));
+  }
+
+ private:
+  mutex mu_;
+  std::vector<std::unique_ptr<_Scratch>> free_;
+};
+
 class LocalityAwareNMSOp : public OpKernel {
  public:
-  explicit LocalityAwareNMSOp(OpKernelConstruction* context) : OpKernel(context) {}
+  explicit LocalityAwareNMSOp(OpKernelConstruction* context) : OpKernel(context) {
+    _get_attr_limits(context, &limits_);
+    OP_REQUIRES_OK(context, context->GetAttr("scale", &vertex_scale_));
+    OP_REQUIRES_OK(context, context->GetAttr("return_indices", &return_indices_));
+    OP_REQUIRES_OK(context, context->GetAttr("return_stats", &return_stats_));
+    OP_REQUIRES_OK(context, context->GetAttr("merge_window", &merge_window_));
+    OP_REQUIRES(context, merge_window_ >= 1, errors::InvalidArgument("merge_window must be at least 1"));
+  }
 
   void Compute(OpKernelContext* context) override {
     const float iou_threshold = _get_input_iou_threshold(context);
-    std::vector<nms::BoundingBox> bounding_boxes = _get_input_bounding_boxes(context);
-    std::vector<nms::BoundingBox> merged_bounding_boxes = nms::locality_aware_nms(bounding_boxes, iou_threshold);
-    _populate_output_tensors(context, merged_bounding_boxes);
+    nms::BoundingBoxView bounding_boxes = _get_input_bounding_boxes(context, vertex_scale_);
+    if (!context->status().ok()) {
+      return;
+    }
+    // The stages are traced separately, see the TensorFlow profiler.
+    nms::Counters counters;
+    auto num_bands = _get_num_bands(context, bounding_boxes.size);
+    auto parallel_for = _get_parallel_for(context);
+    nms::Trace trace_stage = _trace_locality_aware_nms;
+    auto scratch = scratch_pool_.acquire();
+    std::vector<nms::BoundingBox> merged_bounding_boxes, bounding_boxes_to_keep;
+    {
+      profiler::TraceMe trace("LocalityAwareNMS:merge");
+      merged_bounding_boxes = nms::locality_aware_merge(
+          bounding_boxes, iou_threshold, num_bands, &parallel_for, merge_window_, &counters,
+          return_indices_ ? &scratch->merged_indices : nullptr, limits_, &scratch->workspace, &trace_stage);
+    }
+    {
+      profiler::TraceMe trace("LocalityAwareNMS:suppress");
+      bounding_boxes_to_keep = nms::suppress_merged(
+          merged_bounding_boxes, scratch->merged_indices, iou_threshold, &counters,
+          return_indices_ ? &scratch->contributing_indices : nullptr, limits_, &scratch->workspace);
+    }
+    profiler::TraceMe trace("LocalityAwareNMS:outputs");
+    _populate_output_tensors(context, bounding_boxes_to_keep);
+    _populate_output_indices(context, 2, scratch->contributing_indices.indices);
+    _populate_output_indices(context, 3, scratch->contributing_indices.offsets);
+    _populate_output_stats(context, 4, counters, return_stats_);
+    scratch_pool_.release(std::move(scratch));
+    _log_counters("LocalityAwareNMS", counters);
   }
+
+ private:
+  nms::Limits limits_;
+  float vertex_scale_;
+  bool return_indices_;
+  bool return_stats_;
+  int merge_window_;
+  _ScratchPool scratch_pool_;
 };
 
 REGISTER_KERNEL_BUILDER(Name("LocalityAwareNMS").Device(DEVICE_CPU), LocalityAwareNMSOp);
 
 class StandardNMSOp : public OpKernel {
  public:
-  explicit StandardNMSOp(OpKernelConstruction* context) : OpKernel(context) {}
+  explicit StandardNMSOp(OpKernelConstruction* context) : OpKernel(context) {
+    _get_attr_limits(context, &limits_);
+    OP_REQUIRES_OK(context, context->GetAttr("scale", &vertex_scale_));
+    OP_REQUIRES_OK(context, context->GetAttr("return_indices", &return_indices_));
+  }
 
   void Compute(OpKernelContext* context) override {
     const float iou_threshold = _get_input_iou_threshold(context);
-    std::vector<nms::BoundingBox> bounding_boxes = _get_input_bounding_boxes(context);
-    std::vector<nms::BoundingBox> merged_bounding_boxes = nms::standard_nms(bounding_boxes, iou_threshold);
-    _populate_output_tensors(context, merged_bounding_boxes);
+    nms::BoundingBoxView bounding_boxes = _get_input_bounding_boxes(context, vertex_scale_);
+    if (!context->status().ok()) {
+      return;
+    }
+    nms::Counters counters;
+    auto scratch = scratch_pool_.acquire();
+    std::vector<std::size_t> keep_indices = nms::standard_nms_indices(bounding_boxes, iou_threshold, &counters, limits_,
+                                                                      &scratch->workspace);
+    scratch_pool_.release(std::move(scratch));
+    _populate_output_tensors(context, bounding_boxes, keep_indices);
+    _populate_output_indices(context, 2, return_indices_ ? keep_indices : std::vector<std::size_t>());
+    _log_counters("StandardNMS", counters);
   }
+
+ private:
+  nms::Limits limits_;
+  float vertex_scale_;
+  bool return_indices_;
+  _ScratchPool scratch_pool_;
 };
 
 REGISTER_KERNEL_BUILDER(Name("StandardNMS").Device(DEVICE_CPU), StandardNMSOp);
+
+class SoftNMSOp : public OpKernel {
+ public:
+  explicit SoftNMSOp(OpKernelConstruction* context) : OpKernel(context) {
+    std::string method;
+    _get_attr_limits(context, &limits_);
+    OP_REQUIRES_OK(context, context->GetAttr("scale", &vertex_scale_));
+    OP_REQUIRES_OK(context, context->GetAttr("method", &method));
+    OP_REQUIRES_OK(context, context->GetAttr("sigma", &sigma_));
+    OP_REQUIRES_OK(context, context->GetAttr("return_indices", &return_indices_));
+    OP_REQUIRES(context, sigma_ > 0, errors::InvalidArgument("sigma must be positive"));
+    method_ = method == "gaussian" ? nms::kSoftNMSGaussian : nms::kSoftNMSLinear;
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const float iou_threshold = _get_input_iou_threshold(context);
+    nms::BoundingBoxView bounding_boxes = _get_input_bounding_boxes(context, vertex_scale_);
+    if (!context->status().ok()) {
+      return;
+    }
+    nms::Counters counters;
+    auto scratch = scratch_pool_.acquire();
+    std::vector<std::size_t> keep_indices = nms::soft_nms_indices(
+        bounding_boxes, method_, iou_threshold, sigma_, &scratch->scores, &counters, limits_, &scratch->workspace);
+    _populate_output_tensors(context, bounding_boxes, keep_indices, scratch->scores.data());
+    scratch_pool_.release(std::move(scratch));
+    _populate_output_indices(context, 2, return_indices_ ? keep_indices : std::vector<std::size_t>());
+    _log_counters("SoftNMS", counters);
+  }
+
+ private:
+  nms::Limits limits_;
+  float vertex_scale_;
+  nms::SoftNMSMethod method_;
+  float sigma_;
+  bool return_indices_;
+  _ScratchPool scratch_pool_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("SoftNMS").Device(DEVICE_CPU), SoftNMSOp);
+
+class ClassAwareStandardNMSOp : public OpKernel {
+ public:
+  explicit ClassAwareStandardNMSOp(OpKernelConstruction* context) : OpKernel(context) {
+    _get_attr_limits(context, &limits_);
+    OP_REQUIRES_OK(context, context->GetAttr("scale", &vertex_scale_));
+    OP_REQUIRES_OK(context, context->GetAttr("class_agnostic", &class_agnostic_));
+    OP_REQUIRES_OK(context, context->GetAttr("return_indices", &return_indices_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const float iou_threshold = _get_input_iou_threshold(context, 3);
+    nms::BoundingBoxView bounding_boxes = _get_input_bounding_boxes(context, vertex_scale_);
+    if (!context->status().ok()) {
+      return;
+    }
+    const int *class_ids = _get_input_class_ids(context, bounding_boxes);
+    if (!context->status().ok()) {
+      return;
+    }
+    nms::Counters counters;
+    auto parallel_for = _get_parallel_for(context);
+    auto scratch = scratch_pool_.acquire();
+    std::vector<std::size_t> keep_indices = class_agnostic_
+        ? nms::standard_nms_indices(bounding_boxes, iou_threshold, &counters, limits_, &scratch->workspace)
+        : nms::class_aware_standard_nms_indices(bounding_boxes, class_ids, iou_threshold, &parallel_for, &counters,
+                                                limits_, &scratch->workspace);
+    scratch_pool_.release(std::move(scratch));
+    std::vector<int> output_class_ids;
+    for (auto &&i : keep_indices) {
+      output_class_ids.push_back(class_ids[i]);
+    }
+    _populate_output_tensors(context, bounding_boxes, keep_indices);
+    _populate_output_class_ids(context, 2, output_class_ids);
+    _populate_output_indices(context, 3, return_indices_ ? keep_indices : std::vector<std::size_t>());
+    _log_counters("ClassAwareStandardNMS", counters);
+  }
+
+ private:
+  nms::Limits limits_;
+  float vertex_scale_;
+  bool class_agnostic_;
+  bool return_indices_;
+  _ScratchPool scratch_pool_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("ClassAwareStandardNMS").Device(DEVICE_CPU), ClassAwareStandardNMSOp);
+
+class ClassAwareLocalityAwareNMSOp : public OpKernel {
+ public:
+  explicit ClassAwareLocalityAwareNMSOp(OpKernelConstruction* context) : OpKernel(context) {
+    _get_attr_limits(context, &limits_);
+    OP_REQUIRES_OK(context, context->GetAttr("scale", &vertex_scale_));
+    OP_REQUIRES_OK(context, context->GetAttr("class_agnostic", &class_agnostic_));
+    OP_REQUIRES_OK(context, context->GetAttr("return_indices", &return_indices_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const float iou_threshold = _get_input_iou_threshold(context, 3);
+    nms::BoundingBoxView bounding_boxes = _get_input_bounding_boxes(context, vertex_scale_);
+    if (!context->status().ok()) {
+      return;
+    }
+    const int *class_ids = _get_input_class_ids(context, bounding_boxes);
+    if (!context->status().ok()) {
+      return;
+    }
+    nms::Counters counters;
+    auto parallel_for = _get_parallel_for(context);
+    auto scratch = scratch_pool_.acquire();
+    auto &contributing_indices = scratch->contributing_indices;
+    std::vector<int> output_class_ids;
+    std::vector<nms::BoundingBox> merged_bounding_boxes;
+    if (class_agnostic_) {
+      // Boxes of all classes are merged together, each merged box takes the class of its highest
+      // scored contributing box.
+      merged_bounding_boxes = nms::locality_aware_merge(
+          bounding_boxes, iou_threshold, _get_num_bands(context, bounding_boxes.size), &parallel_for, 1, &counters,
+          &scratch->merged_indices, limits_, &scratch->workspace);
+      merged_bounding_boxes = nms::suppress_merged(
+          merged_bounding_boxes, scratch->merged_indices, iou_threshold, &counters, &contributing_indices, limits_,
+          &scratch->workspace);
+      for (std::size_t k = 0; k < merged_bounding_boxes.size(); k++) {
+        auto begin = contributing_indices.indices.begin() + contributing_indices.offsets[k];
+        auto end = contributing_indices.indices.begin() + contributing_indices.offsets[k + 1];
+        auto best = std::min_element(begin, end, [&bounding_boxes](std::size_t i, std::size_t j) {
+          return bounding_boxes.scores[i] > bounding_boxes.scores[j] ||
+                 (bounding_boxes.scores[i] == bounding_boxes.scores[j] && i < j);
+        });
+        output_class_ids.push_back(class_ids[*best]);
+      }
+    } else {
+      merged_bounding_boxes = nms::class_aware_locality_aware_nms(
+          bounding_boxes, class_ids, iou_threshold, &parallel_for, &counters, &contributing_indices,
+          &output_class_ids, limits_, &scratch->workspace);
+    }
+    if (!return_indices_) {
+      contributing_indices.indices.clear();
+      contributing_indices.offsets.clear();
+    }
+    _populate_output_tensors(context, merged_bounding_boxes);
+    _populate_output_class_ids(context, 2, output_class_ids);
+    _populate_output_indices(context, 3, contributing_indices.indices);
+    _populate_output_indices(context, 4, contributing_indices.offsets);
+    scratch_pool_.release(std::move(scratch));
+    _log_counters("ClassAwareLocalityAwareNMS", counters);
+  }
+
+ private:
+  nms::Limits limits_;
+  float vertex_scale_;
+  bool class_agnostic_;
+  bool return_indices_;
+  _ScratchPool scratch_pool_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("ClassAwareLocalityAwareNMS").Device(DEVICE_CPU), ClassAwareLocalityAwareNMSOp);
+
+class TiledLocalityAwareNMSOp : public OpKernel {
+ public:
+  explicit TiledLocalityAwareNMSOp(OpKernelConstruction* context) : OpKernel(context) {
+    _get_attr_limits(context, &limits_);
+    OP_REQUIRES_OK(context, context->GetAttr("scale", &vertex_scale_));
+    OP_REQUIRES_OK(context, context->GetAttr("tile_width", &tile_width_));
+    OP_REQUIRES_OK(context, context->GetAttr("tile_height", &tile_height_));
+    OP_REQUIRES_OK(context, context->GetAttr("margin", &margin_));
+    OP_REQUIRES(context, tile_width_ > 0 && tile_height_ > 0,
+        errors::InvalidArgument("tile_width and tile_height must be positive"));
+    OP_REQUIRES(context, margin_ >= 0, errors::InvalidArgument("margin must be non-negative"));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const float iou_threshold = _get_input_iou_threshold(context, 4);
+    nms::BoundingBoxView bounding_boxes = _get_input_bounding_boxes(context, vertex_scale_);
+    if (!context->status().ok()) {
+      return;
+    }
+    const Tensor& tile_offsets = context->input(3);
+    const int *tile_ids = _get_input_tile_ids(context, bounding_boxes, tile_offsets);
+    if (!context->status().ok()) {
+      return;
+    }
+    nms::TileLayout tiles{tile_offsets.flat<float>().data(), std::size_t(tile_offsets.dim_size(0)),
+                          tile_width_, tile_height_, margin_};
+    nms::Counters counters;
+    auto parallel_for = _get_parallel_for(context);
+    auto scratch = scratch_pool_.acquire();
+    std::vector<nms::BoundingBox> bounding_boxes_to_keep = nms::tiled_locality_aware_nms(
+        bounding_boxes, tile_ids, tiles, iou_threshold, &parallel_for, &counters, limits_, &scratch->workspace);
+    scratch_pool_.release(std::move(scratch));
+    _populate_output_tensors(context, bounding_boxes_to_keep);
+    _log_counters("TiledLocalityAwareNMS", counters);
+  }
+
+ private:
+  nms::Limits limits_;
+  float vertex_scale_;
+  float tile_width_;
+  float tile_height_;
+  float margin_;
+  _ScratchPool scratch_pool_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("TiledLocalityAwareNMS").Device(DEVICE_CPU), TiledLocalityAwareNMSOp);
+
+class GeometryMapLocalityAwareNMSOp : public OpKernel {
+  // Decodes and merges bounding boxes straight from the EAST outputs, the decoded bounding boxes
+  // are never materialized.
+ public:
+  explicit GeometryMapLocalityAwareNMSOp(OpKernelConstruction* context) : OpKernel(context) {
+    _get_attr_limits(context, &limits_);
+    OP_REQUIRES_OK(context, context->GetAttr("scale", &scale_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& score_map = context->input(0);
+    const Tensor& geometry_map = context->input(1);
+    const float iou_threshold = _get_input_iou_threshold(context);
+    OP_REQUIRES(context, score_map.dims() == 2,
+        errors::InvalidArgument("score_map must be 2-D", score_map.shape().DebugString()));
+    OP_REQUIRES(context, geometry_map.dims() == 3 &&
+                         geometry_map.dim_size(0) == score_map.dim_size(0) &&
+                         geometry_map.dim_size(1) == score_map.dim_size(1),
+        errors::InvalidArgument("geometry_map must be shape (height, width, channels)"));
+    OP_REQUIRES(context, geometry_map.dim_size(2) == nms::kRBOXChannels ||
+                         geometry_map.dim_size(2) == nms::kQUADChannels,
+        errors::InvalidArgument("geometry_map must have 5 (RBOX) or 8 (QUAD) channels"));
+    if (!context->status().ok()) {
+      return;
+    }
+
+    nms::GeometryMap geometry{
+      score_map.flat<float>().data(), geometry_map.flat<float>().data(),
+      std::size_t(geometry_map.dim_size(0)), std::size_t(geometry_map.dim_size(1)),
+      std::size_t(geometry_map.dim_size(2)), scale_};
+    nms::Counters counters;
+    auto scratch = scratch_pool_.acquire();
+    std::vector<nms::BoundingBox> merged_bounding_boxes = nms::locality_aware_nms(
+        geometry, iou_threshold, &counters, limits_, &scratch->workspace);
+    scratch_pool_.release(std::move(scratch));
+    _populate_output_tensors(context, merged_bounding_boxes);
+    _log_counters("GeometryMapLocalityAwareNMS", counters);
+  }
+
+ private:
+  nms::Limits limits_;
+  float scale_;
+  _ScratchPool scratch_pool_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("GeometryMapLocalityAwareNMS").Device(DEVICE_CPU), GeometryMapLocalityAwareNMSOp);
+
+static inline void
+_check_input_batched_bounding_boxes(OpKernelContext* context, const Tensor &vertices, const Tensor &probs,
+                                    const Tensor &valid_counts) {
+  OP_REQUIRES(context, vertices.dims() == 4,
+      errors::InvalidArgument("vertices must be 4-D", vertices.shape().DebugString()));
+  OP_REQUIRES(context, vertices.dim_size(2) == 4 && vertices.dim_size(3) == 2,
+      errors::InvalidArgument("vertices must be shape (?, ?, 4, 2)"));
+
+  OP_REQUIRES(context, probs.dims() == 2,
+      errors::InvalidArgument("probs must be 2-D", probs.shape().DebugString()));
+  OP_REQUIRES(context, probs.dim_size(0) == vertices.dim_size(0) && probs.dim_size(1) == vertices.dim_size(1),
+      errors::InvalidArgument("probs must be shape (batch_size, num_boxes)"));
+
+  OP_REQUIRES(context, valid_counts.dims() == 1 && valid_counts.dim_size(0) == vertices.dim_size(0),
+      errors::InvalidArgument("valid_counts must be shape (batch_size,)"));
+  auto valid_counts_data = valid_counts.vec<int32>();
+  for (int64 b = 0; b < valid_counts.dim_size(0); b++) {
+    OP_REQUIRES(context, valid_counts_data(b) >= 0 && valid_counts_data(b) <= vertices.dim_size(1),
+        errors::InvalidArgument("valid_counts must be in [0, num_boxes]"));
+  }
+}
+
+typedef std::function<std::vector<nms::BoundingBox>(const nms::BoundingBoxView &, float, nms::Counters *,
+                                                    const nms::Limits &, nms::Workspace *)>
+    NMSFunction;
+
+class BatchedNMSOp : public OpKernel {
+  // Applies an NMS function to each image of a batch concurrently. The outputs are padded with
+  // zeros to the largest number of output bounding boxes in the batch.
+ public:
+  BatchedNMSOp(OpKernelConstruction* context, const char *name, NMSFunction nms_function)
+      : OpKernel(context), name_(name), nms_function_(nms_function) {
+    _get_attr_limits(context, &limits_);
+    OP_REQUIRES_OK(context, context->GetAttr("scale", &vertex_scale_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& vertices = context->input(0);
+    const Tensor& probs = context->input(1);
+    const Tensor& valid_counts = context->input(2);
+    const float iou_threshold = context->input(3).scalar<float>()();
+    _check_input_iou_threshold(context, iou_threshold);
+    _check_input_batched_bounding_boxes(context, vertices, probs, valid_counts);
+    if (!context->status().ok()) {
+      return;
+    }
+
+    auto batch_size = vertices.dim_size(0);
+    auto num_boxes = vertices.dim_size(1);
+    nms::ValueType vertex_type;
+    const void *vertices_data = _get_vertices_data(vertices, &vertex_type);
+    nms::BoundingBoxView batch{
+      vertices_data, vertex_type, vertex_scale_, probs.flat<float>().data(), std::size_t(batch_size * num_boxes)};
+    auto valid_counts_data = valid_counts.vec<int32>();
+
+    std::vector<std::vector<nms::BoundingBox>> results(batch_size);
+    std::vector<nms::Counters> counters(batch_size);
+    auto process_image = [&](int64 begin, int64 end) {
+      auto scratch = scratch_pool_.acquire();
+      for (auto b = begin; b < end; b++) {
+        auto bounding_boxes = batch.slice(b * num_boxes, valid_counts_data(b));
+        results[b] = nms_function_(bounding_boxes, iou_threshold, &counters[b], limits_, &scratch->workspace);
+      }
+      scratch_pool_.release(std::move(scratch));
+    };
+
+    // Roughly the cost of ingesting and merging the bounding boxes of one image.
+    auto worker_threads = context->device()->tensorflow_cpu_worker_threads();
+    const int64 cost_per_image = 1000 * std::max(int64(1), vertices.dim_size(1));
+    Shard(worker_threads->num_threads, worker_threads->workers, batch_size, cost_per_image, process_image);
+
+    std::size_t max_count = 0;
+    nms::Counters total_counters;
+    for (int64 b = 0; b < batch_size; b++) {
+      max_count = std::max(max_count, results[b].size());
+      total_counters += counters[b];
+    }
+
+    Tensor* vertices_output = NULL;
+    TensorShape vertices_output_shape({batch_size, int64(max_count), 4, 2});
+    OP_REQUIRES_OK(context, context->allocate_output(0, vertices_output_shape, &vertices_output));
+
+    Tensor* scores_output = NULL;
+    TensorShape scores_output_shape({batch_size, int64(max_count)});
+    OP_REQUIRES_OK(context, context->allocate_output(1, scores_output_shape, &scores_output));
+
+    Tensor* counts_output = NULL;
+    TensorShape counts_output_shape({batch_size});
+    OP_REQUIRES_OK(context, context->allocate_output(2, counts_output_shape, &counts_output));
+
+    float *vertices_output_data = vertices_output->flat<float>().data();
+    float *scores_output_data = scores_output->flat<float>().data();
+    auto counts_output_data = counts_output->vec<int32>();
+    std::fill_n(vertices_output_data, vertices_output->NumElements(), 0.0f);
+    std::fill_n(scores_output_data, scores_output->NumElements(), 0.0f);
+    for (int64 b = 0; b < batch_size; b++) {
+      const auto &bounding_boxes = results[b];
+      for (std::size_t i = 0; i < bounding_boxes.size(); i++) {
+        _write_bounding_box(bounding_boxes[i], vertices_output_data + 8 * (b * max_count + i),
+                            scores_output_data + b * max_count + i);
+      }
+      counts_output_data(b) = bounding_boxes.size();
+    }
+
+    _log_counters(name_, total_counters);
+  }
+
+ private:
+  const char *name_;
+  NMSFunction nms_function_;
+  nms::Limits limits_;
+  float vertex_scale_;
+  _ScratchPool scratch_pool_;
+};
+
+class BatchedLocalityAwareNMSOp : public BatchedNMSOp {
+ public:
+  explicit BatchedLocalityAwareNMSOp(OpKernelConstruction* context)
+      : BatchedNMSOp(context, "BatchedLocalityAwareNMS",
+                     [](const nms::BoundingBoxView &bounding_boxes, float iou_threshold, nms::Counters *counters,
+                        const nms::Limits &limits, nms::Workspace *workspace) {
+                       auto merged_bounding_boxes = nms::locality_aware_merge(
+                           bounding_boxes, iou_threshold, 1, nullptr, 1, counters, nullptr, limits, workspace);
+                       return nms::suppress_merged(merged_bounding_boxes, nms::IndexLists(), iou_threshold, counters,
+                                                   nullptr, limits, workspace);
+                     }) {}
+};
+
+REGISTER_KERNEL_BUILDER(Name("BatchedLocalityAwareNMS").Device(DEVICE_CPU), BatchedLocalityAwareNMSOp);
+
+class BatchedStandardNMSOp : public BatchedNMSOp {
+ public:
+  explicit BatchedStandardNMSOp(OpKernelConstruction* context)
+      : BatchedNMSOp(context, "BatchedStandardNMS",
+                     [](const nms::BoundingBoxView &bounding_boxes, float iou_threshold, nms::Counters *counters,
+                        const nms::Limits &limits, nms::Workspace *workspace) {
+                       std::vector<nms::BoundingBox> kept_bounding_boxes;
+                       for (auto &&i : nms::standard_nms_indices(bounding_boxes, iou_threshold, counters, limits,
+                                                                 workspace)) {
+                         kept_bounding_boxes.push_back(bounding_boxes[i]);
+                       }
+                       return kept_bounding_boxes;
+                     }) {}
+};
+
+REGISTER_KERNEL_BUILDER(Name("BatchedStandardNMS").Device(DEVICE_CPU), BatchedStandardNMSOp);
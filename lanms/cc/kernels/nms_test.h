@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -49,6 +56,55 @@ TEST(should_merge, two_squares) {
   EXPECT_FALSE(nms::should_merge(b1, b2, iou + 0.1));
 }
 
+TEST(should_merge, counter_clockwise_and_degenerate) {
+  nms::BoundingBox b1{
+    {{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}},
+    1.0
+  };
+
+  // Counter-clockwise, stored clockwise starting at the same vertex.
+  nms::BoundingBox b2{
+    {{2.0, 0.0}, {2.0, 10.0}, {12.0, 10.0}, {12.0, 0.0}},
+    1.0
+  };
+  EXPECT_EQ(12.0, b2.poly[1].x);
+  EXPECT_TRUE(nms::should_merge(b1, b2, 0.5));
+  EXPECT_FLOAT_EQ(11.0, nms::weighted_merge(b1, b2).poly[1].x);
+
+  nms::BoundingBox line{
+    {{0.0, 5.0}, {10.0, 5.0}, {10.0, 5.0}, {0.0, 5.0}},
+    1.0
+  };
+  EXPECT_FALSE(nms::should_merge(line, line, 0.1));
+  EXPECT_FALSE(nms::should_merge(b1, line, 0.1));
+}
+
+TEST(should_merge, prefilter_rejects_without_clipping) {
+  nms::BoundingBox b1{
+    {{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}},
+    1.0
+  };
+
+  // Disjoint bounding boxes.
+  nms::BoundingBox b2{
+    {{20.0, 0.0}, {30.0, 0.0}, {30.0, 10.0}, {20.0, 10.0}},
+    1.0
+  };
+
+  // Overlapping bounding boxes, but the intersection over union is at most 50 / 150.
+  nms::BoundingBox b3{
+    {{5.0, 0.0}, {15.0, 0.0}, {15.0, 10.0}, {5.0, 10.0}},
+    1.0
+  };
+
+  nms::Counters counters;
+  EXPECT_FALSE(nms::should_merge(b1, b2, 0.1, &counters));
+  EXPECT_FALSE(nms::should_merge(b1, b3, 0.5, &counters));
+  EXPECT_TRUE(nms::should_merge(b1, b3, 0.3, &counters));
+  EXPECT_EQ(3, counters.iou_tests);
+  EXPECT_EQ(2, counters.prefilter_rejects);
+}
+
 TEST(weighted_merge, square_with_itself) {
   nms::BoundingBox b{
     {{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}},
@@ -103,6 +159,29 @@ TEST(weighted_merge, two_square_non_equal_scores) {
   EXPECT_FLOAT_EQ(1.5, mb.score);
 }
 
+TEST(weighted_merge, independent_of_merge_order) {
+  std::vector<nms::BoundingBox> bounding_boxes{
+    {{{0.1, 0.3}, {10.7, 0.2}, {10.3, 10.9}, {0.2, 10.1}}, 0.93},
+    {{{1.3, 0.9}, {11.1, 0.4}, {11.6, 10.2}, {0.7, 9.8}}, 0.61},
+    {{{0.6, 0.1}, {9.9, 0.8}, {10.8, 10.4}, {1.1, 10.6}}, 0.77},
+  };
+
+  nms::MergeAccumulator forward, backward;
+  for (std::size_t i = 0; i < bounding_boxes.size(); i++) {
+    forward.add(bounding_boxes[i]);
+    backward.add(bounding_boxes[bounding_boxes.size() - 1 - i]);
+  }
+  auto a = forward.bounding_box();
+  auto b = backward.bounding_box();
+  for (std::size_t i = 0; i < 4; i++) {
+    EXPECT_EQ(a.poly[i].x, b.poly[i].x);
+    EXPECT_EQ(a.poly[i].y, b.poly[i].y);
+    EXPECT_FLOAT_EQ((0.93 * bounding_boxes[0].poly[i].x + 0.61 * bounding_boxes[1].poly[i].x +
+                     0.77 * bounding_boxes[2].poly[i].x) / 2.31, a.poly[i].x);
+  }
+  EXPECT_FLOAT_EQ(2.31, a.score);
+}
+
 TEST(standard_nms, single_square) {
   nms::BoundingBox b{
     {{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}},
@@ -167,5 +246,695 @@ TEST(standard_nms, two_squares_without_overlap) {
   EXPECT_FLOAT_EQ(0.9, res[1].score);
 }
 
+static void
+_expect_same_bounding_boxes(const std::vector<nms::BoundingBox> &expected, const std::vector<nms::BoundingBox> &res) {
+  ASSERT_EQ(expected.size(), res.size());
+  for (std::size_t i = 0; i < res.size(); i++) {
+    EXPECT_EQ(expected[i].score, res[i].score);
+    for (std::size_t k = 0; k < 4; k++) {
+      EXPECT_EQ(expected[i].poly[k].x, res[i].poly[k].x);
+      EXPECT_EQ(expected[i].poly[k].y, res[i].poly[k].y);
+    }
+  }
+}
+
+static void
+_threads(std::size_t n, const std::function<void(std::size_t)> &fn) {
+  // A nms::ParallelFor running each item on its own thread.
+  std::vector<std::thread> workers;
+  for (std::size_t i = 0; i < n; i++) {
+    workers.emplace_back(fn, i);
+  }
+  for (auto &&w : workers) {
+    w.join();
+  }
+}
+
+static void
+_sequential(std::size_t n, const std::function<void(std::size_t)> &fn) {
+  // A nms::ParallelFor running all items on the calling thread.
+  for (std::size_t i = 0; i < n; i++) {
+    fn(i);
+  }
+}
+
+TEST(standard_nms, spatial_index_matches_exhaustive_search) {
+  // Dense rows of overlapping rotated rectangles with distinct scores.
+  std::vector<nms::BoundingBox> bounding_boxes;
+  for (std::size_t i = 0; i < 400; i++) {
+    float angle = (i % 7) * 0.05;
+    float cx = 7.0 * (i % 40) + (i % 3);
+    float cy = 9.0 * (i / 40) + (i % 5);
+    float w = 20.0 + (i % 11);
+    float h = 8.0 + (i % 4);
+    float c = std::cos(angle);
+    float s = std::sin(angle);
+    float dx[4] = {-w / 2, w / 2, w / 2, -w / 2};
+    float dy[4] = {-h / 2, -h / 2, h / 2, h / 2};
+    geom::Quad q;
+    for (std::size_t k = 0; k < 4; k++) {
+      q[k] = geom::Point{cx + c * dx[k] - s * dy[k], cy + s * dx[k] + c * dy[k]};
+    }
+    bounding_boxes.push_back(nms::BoundingBox(q, ((i * 7919) % 400) / 400.0));
+  }
+
+  for (float iou_threshold : {0.1, 0.3, 0.5}) {
+    // Exhaustive reference using the same overlap computation.
+    std::vector<nms::BoundingBox> candidates = bounding_boxes;
+    std::sort(candidates.begin(), candidates.end(), [](const nms::BoundingBox &a, const nms::BoundingBox &b) {
+      return a.score > b.score;
+    });
+    std::vector<nms::BoundingBox> expected;
+    std::vector<bool> suppressed(candidates.size(), false);
+    for (std::size_t i = 0; i < candidates.size(); i++) {
+      if (suppressed[i]) {
+        continue;
+      }
+      expected.push_back(candidates[i]);
+      for (std::size_t j = i + 1; j < candidates.size(); j++) {
+        float iou;
+        geom::intersection_over_union(candidates[i].poly, &candidates[j].poly, 1, &iou);
+        suppressed[j] = suppressed[j] || iou >= iou_threshold;
+      }
+    }
+
+    auto res = nms::standard_nms(bounding_boxes, iou_threshold);
+    _expect_same_bounding_boxes(expected, res);
+  }
+}
+
+static std::vector<nms::BoundingBox>
+_text_line_bounding_boxes(std::size_t n) {
+  // Rows of slightly shifted, overlapping rectangles as produced for lines of text.
+  std::vector<nms::BoundingBox> bounding_boxes;
+  for (std::size_t i = 0; i < n; i++) {
+    float x = 4.0 * (i % 50) + (i % 3);
+    float y = 15.0 * ((i * 7) % (n / 25 + 1)) + (i % 4);
+    geom::Quad q{{x, y}, {x + 30.0f, y + 1.0f}, {x + 30.0f, y + 11.0f}, {x, y + 10.0f}};
+    bounding_boxes.push_back(nms::BoundingBox(q, 0.5 + 0.5 * ((i * 31) % 97) / 97.0));
+  }
+  return bounding_boxes;
+}
+
+TEST(locality_aware_nms, empty_input) {
+  std::vector<nms::BoundingBox> bounding_boxes;
+  EXPECT_EQ(0, nms::locality_aware_nms(bounding_boxes, 0.3).size());
+}
+
+TEST(locality_aware_nms, parallel_bands_match_sequential) {
+  // A column of slowly shifting bounding boxes merges into a single run crossing band boundaries.
+  auto bounding_boxes = _text_line_bounding_boxes(2000);
+  for (std::size_t i = 0; i < 300; i++) {
+    float y = 0.5 * i;
+    geom::Quad q{{500.0f, y}, {540.0f, y}, {540.0f, y + 10.0f}, {500.0f, y + 10.0f}};
+    bounding_boxes.push_back(nms::BoundingBox(q, 0.9));
+  }
+  nms::Counters expected_counters;
+  auto expected = nms::locality_aware_nms(bounding_boxes, 0.3, &expected_counters);
+
+  nms::ParallelFor threads = _threads;
+
+  for (std::size_t num_bands : {1, 2, 3, 8, 64, 2000}) {
+    nms::Counters counters;
+    auto res = nms::locality_aware_nms(bounding_boxes, 0.3, num_bands, threads, &counters);
+    EXPECT_EQ(expected_counters.iou_tests, counters.iou_tests);
+    EXPECT_EQ(expected_counters.prefilter_rejects, counters.prefilter_rejects);
+    EXPECT_EQ(expected_counters.input_bounding_boxes, counters.input_bounding_boxes);
+    EXPECT_EQ(expected_counters.merged_bounding_boxes, counters.merged_bounding_boxes);
+    EXPECT_EQ(expected_counters.kept_bounding_boxes, counters.kept_bounding_boxes);
+    _expect_same_bounding_boxes(expected, res);
+  }
+}
+
+TEST(locality_aware_nms, row_wise_order_with_ties) {
+  // Enough bounding boxes for a radix sort, many sharing their top most y coordinate with others,
+  // including negative coordinates and -0, must merge in the same order as a stable sort by min_y.
+  auto bounding_boxes = _text_line_bounding_boxes(3000);
+  for (std::size_t i = 0; i < bounding_boxes.size(); i += 5) {
+    auto q = bounding_boxes[i].poly;
+    float dy = (i % 2 ? 0.0f : -20.0f) - nms::min_y(bounding_boxes[i]);
+    for (std::size_t k = 0; k < 4; k++) {
+      q[k].y += dy;
+      if (q[k].y == 0.0f && i % 4 == 1) {
+        q[k].y = -0.0f;
+      }
+    }
+    bounding_boxes[i] = nms::BoundingBox(q, bounding_boxes[i].score);
+  }
+
+  std::vector<nms::BoundingBox> sorted(bounding_boxes);
+  std::stable_sort(sorted.begin(), sorted.end(), [](const nms::BoundingBox &a, const nms::BoundingBox &b) {
+    return nms::min_y(a) < nms::min_y(b);
+  });
+  std::vector<nms::BoundingBox> merged{sorted[0]};
+  nms::MergeAccumulator group(sorted[0]);
+  for (std::size_t i = 1; i < sorted.size(); i++) {
+    if (nms::should_merge(merged.back(), sorted[i], 0.3)) {
+      group.add(sorted[i]);
+      merged.back() = group.bounding_box();
+    } else {
+      merged.push_back(sorted[i]);
+      group = nms::MergeAccumulator(sorted[i]);
+    }
+  }
+  auto expected = nms::standard_nms(merged, 0.3);
+
+  auto res = nms::locality_aware_nms(bounding_boxes, 0.3);
+  _expect_same_bounding_boxes(expected, res);
+}
+
+struct _BoundingBoxBuffers {
+  // Bounding boxes laid out as in the input tensors of the ops.
+  explicit _BoundingBoxBuffers(const std::vector<nms::BoundingBox> &bounding_boxes) {
+    for (auto &&b : bounding_boxes) {
+      for (auto &&p : b.poly) {
+        vertices.push_back(p.x);
+        vertices.push_back(p.y);
+      }
+      scores.push_back(b.score);
+    }
+  }
+
+  nms::BoundingBoxView view() const { return nms::BoundingBoxView{vertices.data(), scores.data(), scores.size()}; }
+
+  std::vector<float> vertices;
+  std::vector<float> scores;
+};
+
+TEST(locality_aware_nms, view_matches_vector) {
+  auto bounding_boxes = _text_line_bounding_boxes(500);
+  _BoundingBoxBuffers buffers(bounding_boxes);
+  auto view = buffers.view();
+  const auto &vertices = buffers.vertices;
+  const auto &scores = buffers.scores;
+
+  auto expected = nms::locality_aware_nms(bounding_boxes, 0.3);
+  auto res = nms::locality_aware_nms(view, 0.3);
+  _expect_same_bounding_boxes(expected, res);
+
+  auto expected_kept = nms::standard_nms(bounding_boxes, 0.3);
+  auto keep_indices = nms::standard_nms_indices(view, 0.3);
+  ASSERT_EQ(expected_kept.size(), keep_indices.size());
+  for (std::size_t i = 0; i < keep_indices.size(); i++) {
+    EXPECT_EQ(expected_kept[i].score, scores[keep_indices[i]]);
+    EXPECT_EQ(expected_kept[i].poly[0].x, vertices[8 * keep_indices[i]]);
+  }
+}
+
+TEST(load_values, conversions) {
+  EXPECT_EQ(1.0f, nms::half_to_float(0x3c00));
+  EXPECT_EQ(-2.5f, nms::half_to_float(0xc100));
+  EXPECT_EQ(65504.0f, nms::half_to_float(0x7bff));
+  EXPECT_EQ(std::ldexp(1.0f, -24), nms::half_to_float(0x0001));
+  EXPECT_TRUE(std::isinf(nms::half_to_float(0x7c00)));
+  EXPECT_TRUE(std::isnan(nms::half_to_float(0x7e00)));
+  EXPECT_EQ(1.0f, nms::bfloat16_to_float(0x3f80));
+  EXPECT_EQ(-2.5f, nms::bfloat16_to_float(0xc020));
+
+  const std::int16_t values[] = {-4, 0, 6};
+  float output[2];
+  nms::load_values(values, nms::kInt16, 0.25, 1, 2, output);
+  EXPECT_EQ(0.0f, output[0]);
+  EXPECT_EQ(1.5f, output[1]);
+}
+
+TEST(locality_aware_nms, typed_view_matches_float_view) {
+  // Integer vertices in 1/4 pixels.
+  std::vector<std::int32_t> int_vertices;
+  std::vector<float> vertices, scores;
+  for (std::size_t i = 0; i < 200; i++) {
+    std::int32_t x = 4 * (37 * i % 400), y = 4 * (7 * i % 60) + i % 3;
+    for (std::int32_t v : {x, y, x + 400, y, x + 400, y + 100, x, y + 100}) {
+      int_vertices.push_back(v);
+      vertices.push_back(0.25f * v);
+    }
+    scores.push_back(0.5 + (i % 5) * 0.1);
+  }
+  std::vector<std::int16_t> short_vertices(int_vertices.begin(), int_vertices.end());
+
+  nms::BoundingBoxView view{vertices.data(), scores.data(), scores.size()};
+  auto expected = nms::locality_aware_nms(view, 0.3);
+  auto expected_indices = nms::standard_nms_indices(view, 0.3);
+  for (auto &&typed_view : {nms::BoundingBoxView{int_vertices.data(), nms::kInt32, 0.25, scores.data(), scores.size()},
+                            nms::BoundingBoxView{short_vertices.data(), nms::kInt16, 0.25, scores.data(), scores.size()}}) {
+    auto res = nms::locality_aware_nms(typed_view, 0.3);
+    ASSERT_EQ(expected.size(), res.size());
+    for (std::size_t i = 0; i < res.size(); i++) {
+      EXPECT_EQ(expected[i].score, res[i].score);
+      EXPECT_EQ(expected[i].poly[0].x, res[i].poly[0].x);
+      EXPECT_EQ(expected[i].poly[2].y, res[i].poly[2].y);
+    }
+    EXPECT_EQ(expected_indices, nms::standard_nms_indices(typed_view, 0.3));
+
+    auto slice = typed_view.slice(50, 10);
+    for (std::size_t i = 0; i < slice.size; i++) {
+      EXPECT_EQ(view[50 + i].poly[1].x, slice[i].poly[1].x);
+      EXPECT_EQ(view[50 + i].score, slice[i].score);
+    }
+  }
+}
+
+TEST(locality_aware_nms, contributing_indices) {
+  geom::Quad q1{{50, 50}, {150, 50}, {150, 100}, {50, 100}};
+  geom::Quad q2{{50, 200}, {150, 200}, {150, 250}, {50, 250}};
+  geom::Quad q3{{60, 50}, {160, 50}, {160, 100}, {60, 100}};
+  std::vector<nms::BoundingBox> bounding_boxes{{q1, 0.5}, {q2, 0.9}, {q3, 0.5}};
+
+  nms::IndexLists contributing_indices;
+  auto res = nms::locality_aware_nms(bounding_boxes, 0.3, nullptr, &contributing_indices);
+  ASSERT_EQ(2, res.size());
+  EXPECT_EQ((std::vector<std::size_t>{0, 2, 3}), contributing_indices.offsets);
+  EXPECT_EQ((std::vector<std::size_t>{0, 2, 1}), contributing_indices.indices);
+}
+
+TEST(locality_aware_nms, parallel_bands_match_sequential_contributing_indices) {
+  auto bounding_boxes = _text_line_bounding_boxes(2000);
+  nms::IndexLists expected;
+  auto expected_res = nms::locality_aware_nms(bounding_boxes, 0.3, nullptr, &expected);
+  EXPECT_EQ(expected_res.size() + 1, expected.offsets.size());
+
+  nms::ParallelFor sequential = _sequential;
+  for (std::size_t num_bands : {2, 8, 2000}) {
+    nms::IndexLists res;
+    nms::locality_aware_nms(bounding_boxes, 0.3, num_bands, sequential, nullptr, &res);
+    EXPECT_EQ(expected.offsets, res.offsets);
+    EXPECT_EQ(expected.indices, res.indices);
+  }
+}
+
+TEST(standard_nms, max_output_size_matches_truncated_output) {
+  auto bounding_boxes = _text_line_bounding_boxes(2000);
+  _BoundingBoxBuffers buffers(bounding_boxes);
+  auto expected = nms::standard_nms_indices(buffers.view(), 0.3);
+
+  for (std::size_t max_output_size : {0, 1, 10, 200, 5000}) {
+    nms::Limits limits;
+    limits.max_output_size = max_output_size;
+    auto res = nms::standard_nms_indices(buffers.view(), 0.3, nullptr, limits);
+    std::vector<std::size_t> truncated(expected.begin(), expected.begin() + std::min(max_output_size, expected.size()));
+    EXPECT_EQ(truncated, res);
+  }
+}
+
+TEST(standard_nms, max_output_size_matches_truncated_output_at_threshold_boundary) {
+  // Thresholds equal to the IoU of overlapping pairs, tested with either box of the pair as anchor,
+  // such that any difference in how the top-k and full paths compute the IoU flips a suppression.
+  auto bounding_boxes = _text_line_bounding_boxes(500);
+  _BoundingBoxBuffers buffers(bounding_boxes);
+  geom::QuadBatch batch;
+  for (auto &&b : bounding_boxes) {
+    batch.push_back(b.poly);
+  }
+
+  std::vector<float> thresholds;
+  for (std::size_t i = 0; i < 40 && thresholds.size() < 16; i++) {
+    std::vector<float> ious(batch.size());
+    geom::intersection_over_union(batch.quad(i), batch, 0, batch.size(), ious.data());
+    for (std::size_t j = 0; j < batch.size(); j++) {
+      if (j != i && ious[j] > 0.05 && ious[j] < 0.95) {
+        thresholds.push_back(ious[j]);
+        break;
+      }
+    }
+  }
+  ASSERT_FALSE(thresholds.empty());
+
+  for (auto iou_threshold : thresholds) {
+    auto expected = nms::standard_nms_indices(buffers.view(), iou_threshold);
+    for (std::size_t max_output_size : {5, 50}) {
+      nms::Limits limits;
+      limits.max_output_size = max_output_size;
+      auto res = nms::standard_nms_indices(buffers.view(), iou_threshold, nullptr, limits);
+      std::vector<std::size_t> truncated(expected.begin(), expected.begin() + std::min(max_output_size, expected.size()));
+      EXPECT_EQ(truncated, res);
+    }
+  }
+}
+
+TEST(locality_aware_nms, score_threshold_matches_filtered_input) {
+  auto bounding_boxes = _text_line_bounding_boxes(1000);
+  std::vector<nms::BoundingBox> filtered;
+  for (auto &&b : bounding_boxes) {
+    if (b.score >= 0.75) {
+      filtered.push_back(b);
+    }
+  }
+  auto expected = nms::locality_aware_nms(filtered, 0.3);
+
+  _BoundingBoxBuffers buffers(bounding_boxes);
+  nms::Limits limits;
+  limits.score_threshold = 0.75;
+  auto res = nms::locality_aware_nms(buffers.view(), 0.3, nullptr, nullptr, limits);
+  ASSERT_EQ(expected.size(), res.size());
+  for (std::size_t i = 0; i < res.size(); i++) {
+    EXPECT_EQ(expected[i].score, res[i].score);
+    EXPECT_EQ(expected[i].poly[0].x, res[i].poly[0].x);
+    EXPECT_EQ(expected[i].poly[0].y, res[i].poly[0].y);
+  }
+}
+
+TEST(locality_aware_nms, stages_match_locality_aware_nms) {
+  auto bounding_boxes = _text_line_bounding_boxes(1000);
+  _BoundingBoxBuffers buffers(bounding_boxes);
+  nms::Limits limits;
+  limits.score_threshold = 0.75;
+
+  for (std::size_t window : {1, 4}) {
+    nms::Counters expected_counters;
+    nms::IndexLists expected_indices;
+    auto expected = nms::locality_aware_nms_windowed(buffers.view(), 0.3, window, &expected_counters,
+                                                     &expected_indices, limits);
+
+    nms::Counters counters;
+    nms::IndexLists merged_indices, indices;
+    auto merged = nms::locality_aware_merge(buffers.view(), 0.3, 1, nullptr, window, &counters, &merged_indices,
+                                            limits);
+    auto res = nms::suppress_merged(merged, merged_indices, 0.3, &counters, &indices, limits);
+    ASSERT_EQ(expected.size(), res.size());
+    EXPECT_EQ(expected_indices.indices, indices.indices);
+    EXPECT_EQ(expected_counters.merged_bounding_boxes, counters.merged_bounding_boxes);
+
+    if (nms::kInstrumentation) {
+      auto expected_inputs = std::count_if(bounding_boxes.begin(), bounding_boxes.end(),
+                                           [](const nms::BoundingBox &b) { return b.score >= 0.75; });
+      EXPECT_EQ(std::size_t(expected_inputs), counters.input_bounding_boxes);
+      EXPECT_EQ(merged.size(), counters.merged_bounding_boxes);
+      EXPECT_EQ(res.size(), counters.kept_bounding_boxes);
+    }
+  }
+}
+
+TEST(locality_aware_merge, traces_the_sort_of_each_band) {
+  auto bounding_boxes = _text_line_bounding_boxes(1000);
+  _BoundingBoxBuffers buffers(bounding_boxes);
+  nms::ParallelFor threads = _threads;
+  std::mutex mutex;
+  std::vector<std::string> stages;
+  nms::Trace trace = [&](const char *name, const std::function<void()> &fn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stages.push_back(name);
+    }
+    fn();
+  };
+
+  for (std::size_t window : {1, 4}) {
+    stages.clear();
+    auto expected = nms::locality_aware_merge(buffers.view(), 0.3, 4, &threads, window);
+    auto res = nms::locality_aware_merge(buffers.view(), 0.3, 4, &threads, window, nullptr, nullptr, nms::Limits(),
+                                         nullptr, &trace);
+    _expect_same_bounding_boxes(expected, res);
+    EXPECT_EQ(std::vector<std::string>(window > 1 ? 1 : 4, "sort"), stages);
+  }
+}
+
+TEST(locality_aware_nms, reused_workspace_matches_fresh_workspace) {
+  nms::ParallelFor sequential = _sequential;
+  nms::Workspace workspace;
+  for (std::size_t n : {2000, 100, 1000}) {
+    for (std::size_t window : {1, 4}) {
+      auto bounding_boxes = _text_line_bounding_boxes(n);
+      _BoundingBoxBuffers buffers(bounding_boxes);
+      nms::IndexLists expected_indices;
+      auto expected = nms::locality_aware_nms_windowed(buffers.view(), 0.3, window, nullptr, &expected_indices);
+
+      nms::IndexLists merged_indices, indices;
+      auto merged = nms::locality_aware_merge(buffers.view(), 0.3, 4, &sequential, window, nullptr, &merged_indices,
+                                              nms::Limits(), &workspace);
+      auto res = nms::suppress_merged(merged, merged_indices, 0.3, nullptr, &indices, nms::Limits(), &workspace);
+      ASSERT_EQ(expected.size(), res.size());
+      EXPECT_EQ(expected_indices.indices, indices.indices);
+      EXPECT_EQ(expected_indices.offsets, indices.offsets);
+
+      EXPECT_EQ(nms::standard_nms_indices(buffers.view(), 0.3),
+                nms::standard_nms_indices(buffers.view(), 0.3, nullptr, nms::Limits(), &workspace));
+
+      nms::IndexLists windowed_indices;
+      res = nms::locality_aware_nms_windowed(buffers.view(), 0.3, window, nullptr, &windowed_indices, nms::Limits(),
+                                             &workspace);
+      ASSERT_EQ(expected.size(), res.size());
+      EXPECT_EQ(expected_indices.indices, windowed_indices.indices);
+      EXPECT_EQ(expected_indices.offsets, windowed_indices.offsets);
+
+      _expect_same_bounding_boxes(nms::standard_nms(bounding_boxes, 0.3),
+                                  nms::standard_nms(bounding_boxes, 0.3, nullptr, nms::Limits(), &workspace));
+      _expect_same_bounding_boxes(
+          nms::soft_nms(bounding_boxes, nms::kSoftNMSLinear, 0.3, 0.5),
+          nms::soft_nms(bounding_boxes, nms::kSoftNMSLinear, 0.3, 0.5, nullptr, nms::Limits(), &workspace));
+    }
+  }
+}
+
+TEST(workspace, reused_by_class_aware_tiled_and_soft_nms) {
+  // Three classes, or tiles side by side, processed concurrently with one workspace across calls.
+  const float tile_offsets[] = {0, 0, 1000, 0, 2000, 0};
+  nms::TileLayout tiles{tile_offsets, 3, 1000, 10000, 50};
+  nms::ParallelFor threads = _threads;
+  nms::Workspace workspace;
+  for (std::size_t n : {2000, 100, 1000}) {
+    auto bounding_boxes = _text_line_bounding_boxes(n);
+    _BoundingBoxBuffers buffers(bounding_boxes);
+    auto view = buffers.view();
+    std::vector<int> ids(n);
+    for (std::size_t i = 0; i < n; i++) {
+      ids[i] = i % 3;
+    }
+
+    EXPECT_EQ(nms::class_aware_standard_nms_indices(view, ids.data(), 0.3, &threads),
+              nms::class_aware_standard_nms_indices(view, ids.data(), 0.3, &threads, nullptr, nms::Limits(),
+                                                    &workspace));
+    _expect_same_bounding_boxes(
+        nms::class_aware_locality_aware_nms(view, ids.data(), 0.3, &threads),
+        nms::class_aware_locality_aware_nms(view, ids.data(), 0.3, &threads, nullptr, nullptr, nullptr,
+                                            nms::Limits(), &workspace));
+    _expect_same_bounding_boxes(
+        nms::tiled_locality_aware_nms(view, ids.data(), tiles, 0.3, &threads),
+        nms::tiled_locality_aware_nms(view, ids.data(), tiles, 0.3, &threads, nullptr, nms::Limits(), &workspace));
+
+    std::vector<float> expected_scores, scores;
+    auto expected = nms::soft_nms_indices(view, nms::kSoftNMSGaussian, 0.3, 0.5, &expected_scores);
+    auto res = nms::soft_nms_indices(view, nms::kSoftNMSGaussian, 0.3, 0.5, &scores, nullptr, nms::Limits(),
+                                     &workspace);
+    EXPECT_EQ(expected, res);
+    EXPECT_EQ(expected_scores, scores);
+  }
+}
+
+TEST(locality_aware_nms_windowed, window_of_one_matches_locality_aware_nms) {
+  auto bounding_boxes = _text_line_bounding_boxes(1000);
+  nms::IndexLists expected_indices;
+  auto expected = nms::locality_aware_nms(bounding_boxes, 0.3, nullptr, &expected_indices);
+
+  nms::IndexLists indices;
+  auto res = nms::locality_aware_nms_windowed(bounding_boxes, 0.3, 1, nullptr, &indices);
+  ASSERT_EQ(expected.size(), res.size());
+  for (std::size_t i = 0; i < res.size(); i++) {
+    EXPECT_EQ(expected[i].score, res[i].score);
+    EXPECT_EQ(expected[i].poly[0].x, res[i].poly[0].x);
+  }
+  EXPECT_EQ(expected_indices.offsets, indices.offsets);
+  EXPECT_EQ(expected_indices.indices, indices.indices);
+}
+
+TEST(locality_aware_nms_windowed, merges_interleaved_text_lines) {
+  // Two text lines side by side whose boxes alternate in row wise order.
+  std::vector<nms::BoundingBox> bounding_boxes;
+  for (std::size_t i = 0; i < 20; i++) {
+    float x = (i % 2) * 100.0 + (i / 2);
+    float y = 0.1 * i;
+    geom::Quad q{{x, y}, {x + 50.0f, y}, {x + 50.0f, y + 10.0f}, {x, y + 10.0f}};
+    bounding_boxes.push_back(nms::BoundingBox(q, 1.0));
+  }
+
+  nms::Counters single_counters;
+  nms::locality_aware_nms(bounding_boxes, 0.3, &single_counters);
+  EXPECT_EQ(20, single_counters.merged_bounding_boxes);
+
+  nms::Counters counters;
+  nms::IndexLists indices;
+  auto res = nms::locality_aware_nms_windowed(bounding_boxes, 0.3, 4, &counters, &indices);
+  EXPECT_EQ(2, counters.merged_bounding_boxes);
+  ASSERT_EQ(2, res.size());
+  EXPECT_FLOAT_EQ(10.0, res[0].score);
+  EXPECT_EQ(20, indices.indices.size());
+}
+
+static std::vector<std::size_t>
+_naive_soft_nms(std::vector<nms::BoundingBox> bounding_boxes, nms::SoftNMSMethod method, float iou_threshold,
+                float sigma, float score_threshold, std::vector<float> *scores) {
+  // Decays all remaining bounding boxes after each selection, in the order they are selected.
+  std::vector<std::size_t> remaining;
+  for (std::size_t i = 0; i < bounding_boxes.size(); i++) {
+    if (bounding_boxes[i].score >= score_threshold) {
+      remaining.push_back(i);
+    }
+  }
+  std::vector<std::size_t> keep_indices;
+  while (remaining.size()) {
+    auto best = std::min_element(remaining.begin(), remaining.end(), [&](std::size_t i, std::size_t j) {
+      return bounding_boxes[i].score > bounding_boxes[j].score;
+    });
+    auto k = *best;
+    remaining.erase(best);
+    keep_indices.push_back(k);
+    scores->push_back(bounding_boxes[k].score);
+
+    std::vector<std::size_t> next;
+    for (auto &&i : remaining) {
+      float iou;
+      geom::intersection_over_union(bounding_boxes[k].poly, &bounding_boxes[i].poly, 1, &iou);
+      float decay = method == nms::kSoftNMSGaussian ? std::exp(-iou * iou / sigma)
+                                                     : (iou >= iou_threshold ? 1.0f - iou : 1.0f);
+      bounding_boxes[i].score *= decay;
+      if (bounding_boxes[i].score >= score_threshold) {
+        next.push_back(i);
+      }
+    }
+    remaining = next;
+  }
+  return keep_indices;
+}
+
+TEST(soft_nms, matches_naive_soft_nms) {
+  auto bounding_boxes = _text_line_bounding_boxes(300);
+  _BoundingBoxBuffers buffers(bounding_boxes);
+  for (auto method : {nms::kSoftNMSLinear, nms::kSoftNMSGaussian}) {
+    std::vector<float> expected_scores;
+    auto expected = _naive_soft_nms(bounding_boxes, method, 0.3, 0.5, 0.01, &expected_scores);
+
+    nms::Limits limits;
+    limits.score_threshold = 0.01;
+    std::vector<float> scores;
+    nms::Counters counters;
+    auto res = nms::soft_nms_indices(buffers.view(), method, 0.3, 0.5, &scores, &counters, limits);
+    EXPECT_EQ(expected, res);
+    EXPECT_EQ(expected_scores, scores);
+    EXPECT_LT(counters.iou_tests, bounding_boxes.size() * bounding_boxes.size() / 2);
+
+    auto kept = nms::soft_nms(bounding_boxes, method, 0.3, 0.5, nullptr, limits);
+    ASSERT_EQ(expected.size(), kept.size());
+    for (std::size_t i = 0; i < kept.size(); i++) {
+      EXPECT_EQ(expected_scores[i], kept[i].score);
+    }
+  }
+}
+
+TEST(soft_nms, linear_decay_prunes_duplicates) {
+  nms::BoundingBox b{{{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}}, 0.9};
+  nms::BoundingBox c{{{20.0, 0.0}, {30.0, 0.0}, {30.0, 10.0}, {20.0, 10.0}}, 0.8};
+  std::vector<nms::BoundingBox> bounding_boxes{b, b, c};
+  bounding_boxes[1].score = 0.7;
+
+  nms::Limits limits;
+  limits.score_threshold = 0.001;
+  auto res = nms::soft_nms(bounding_boxes, nms::kSoftNMSLinear, 0.3, 0.5, nullptr, limits);
+  ASSERT_EQ(2, res.size());
+  EXPECT_FLOAT_EQ(0.9, res[0].score);
+  EXPECT_FLOAT_EQ(0.8, res[1].score);
+}
+
+TEST(class_aware_standard_nms, classes_dont_suppress_each_other) {
+  nms::BoundingBox b{{{0.0, 0.0}, {10.0, 0.0}, {10.0, 10.0}, {0.0, 10.0}}, 0.9};
+  std::vector<nms::BoundingBox> bounding_boxes{b, b, b};
+  bounding_boxes[1].score = 0.8;
+  bounding_boxes[2].score = 0.7;
+  _BoundingBoxBuffers buffers(bounding_boxes);
+
+  std::vector<int> class_ids{3, 3, 7};
+  auto res = nms::class_aware_standard_nms_indices(buffers.view(), class_ids.data(), 0.3);
+  EXPECT_EQ(std::vector<std::size_t>({0, 2}), res);
+
+  std::vector<int> sparse_class_ids{-100000, 100000, 100000};
+  res = nms::class_aware_standard_nms_indices(buffers.view(), sparse_class_ids.data(), 0.3);
+  EXPECT_EQ(std::vector<std::size_t>({0, 1}), res);
+}
+
+TEST(class_aware_locality_aware_nms, matches_per_class_calls) {
+  auto bounding_boxes = _text_line_bounding_boxes(1000);
+  std::vector<int> class_ids;
+  std::vector<std::vector<nms::BoundingBox>> class_bounding_boxes(3);
+  for (std::size_t i = 0; i < bounding_boxes.size(); i++) {
+    class_ids.push_back((i / 7) % 3);
+    class_bounding_boxes[class_ids.back()].push_back(bounding_boxes[i]);
+  }
+  std::vector<float> expected_scores;
+  for (auto &&c : class_bounding_boxes) {
+    for (auto &&b : nms::locality_aware_nms(c, 0.3)) {
+      expected_scores.push_back(b.score);
+    }
+  }
+  std::sort(expected_scores.rbegin(), expected_scores.rend());
+
+  nms::ParallelFor threads = _threads;
+  _BoundingBoxBuffers buffers(bounding_boxes);
+  nms::IndexLists indices;
+  std::vector<int> output_class_ids;
+  auto res = nms::class_aware_locality_aware_nms(buffers.view(), class_ids.data(), 0.3, &threads, nullptr,
+                                                 &indices, &output_class_ids);
+  ASSERT_EQ(expected_scores.size(), res.size());
+  ASSERT_EQ(res.size(), output_class_ids.size());
+  for (std::size_t i = 0; i < res.size(); i++) {
+    EXPECT_EQ(expected_scores[i], res[i].score);
+    for (auto p = indices.offsets[i]; p < indices.offsets[i + 1]; p++) {
+      EXPECT_EQ(output_class_ids[i], class_ids[indices.indices[p]]);
+    }
+  }
+}
+
+TEST(tiled_locality_aware_nms, matches_suppression_of_all_tiles) {
+  // A 3 x 2 grid of 200 x 200 tiles overlapping by 40 pixels. Each tile detects the words it fully
+  // contains, words in the overlaps are detected by several tiles with different scores.
+  const float tile_offsets[] = {0, 0, 160, 0, 320, 0, 0, 160, 160, 160, 320, 160};
+  const std::size_t num_tiles = 6;
+  nms::TileLayout tiles{tile_offsets, num_tiles, 200, 200, 40};
+  std::vector<float> vertices, scores;
+  std::vector<int> tile_ids;
+  std::vector<std::vector<nms::BoundingBox>> tile_bounding_boxes(num_tiles);
+  for (std::size_t i = 0; i < 1500; i++) {
+    float x = (i * 37) % 480 + (i % 3);
+    float y = 11.0 * ((i * 7) % 32) + (i % 5);
+    float w = 20.0 + (i % 4) * 7;
+    for (std::size_t t = 0; t < num_tiles; t++) {
+      float ox = tile_offsets[2 * t], oy = tile_offsets[2 * t + 1];
+      if (x < ox || y < oy || x + w > ox + 200 || y + 10 > oy + 200) {
+        continue;
+      }
+      geom::Quad q{{x - ox, y - oy}, {x + w - ox, y - oy}, {x + w - ox, y + 10 - oy}, {x - ox, y + 10 - oy}};
+      float score = 0.5 + 0.01 * ((i * 13 + t * 7) % 40);
+      for (std::size_t k = 0; k < 4; k++) {
+        vertices.push_back(q[k].x);
+        vertices.push_back(q[k].y);
+        q[k] = geom::Point{q[k].x + ox, q[k].y + oy};
+      }
+      scores.push_back(score);
+      tile_ids.push_back(t);
+      tile_bounding_boxes[t].push_back(nms::BoundingBox(q, score));
+    }
+  }
+  nms::BoundingBoxView view{vertices.data(), scores.data(), scores.size()};
+
+  nms::ParallelFor threads = _threads;
+  for (float iou_threshold : {0.0f, 0.3f, 0.7f}) {
+    std::vector<nms::BoundingBox> merged_bounding_boxes;
+    for (auto &&bounding_boxes : tile_bounding_boxes) {
+      _BoundingBoxBuffers buffers(bounding_boxes);
+      auto merged = nms::locality_aware_merge(buffers.view(), iou_threshold, 1);
+      merged_bounding_boxes.insert(merged_bounding_boxes.end(), merged.begin(), merged.end());
+    }
+    auto expected = nms::suppress_merged(merged_bounding_boxes, nms::IndexLists(), iou_threshold);
+
+    auto res = nms::tiled_locality_aware_nms(view, tile_ids.data(), tiles, iou_threshold, &threads);
+    _expect_same_bounding_boxes(expected, res);
+
+    nms::Limits limits;
+    limits.max_output_size = 10;
+    auto top = nms::tiled_locality_aware_nms(view, tile_ids.data(), tiles, iou_threshold, nullptr, nullptr, limits);
+    ASSERT_EQ(std::min(std::size_t(10), expected.size()), top.size());
+    for (std::size_t i = 0; i < top.size(); i++) {
+      EXPECT_EQ(expected[i].score, top[i].score);
+    }
+  }
+}
+
 // TODO: Should we add basically the same tests for lanms that we already have on python side?
 //  or just make a comment about it.
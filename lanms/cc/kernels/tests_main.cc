@@ -1,6 +1,10 @@
 #include "gtest/gtest.h"
 
 #include "geom_test.h"
+#include "geometry_map_test.h"
+#include "grid_test.h"
+#include "lanms_c_test.h"
+#include "merger_test.h"
 #include "nms_test.h"
 
 
@@ -4,26 +4,217 @@
 using namespace tensorflow;
 
 
+// Vertices of type T are converted to float32 and multiplied by scale as they are read, e.g. to
+// undo the fixed point scale of integer vertices, all geometry is computed and returned in float32.
+// This applies to all ops taking vertices.
+
+// Vertices may be given in either order. All ops return vertices in clockwise order in image
+// coordinates (y pointing down), counter-clockwise boxes are reversed starting from their first
+// vertex, such that all ops return the same vertices for the same kept box.
+
+// Boxes scored below score_threshold are dropped before merging and at most max_output_size boxes
+// are returned unless it is negative. If return_indices is false the index outputs are empty. Up to
+// merge_window merged boxes are kept open while merging, see nms::locality_aware_nms_windowed.
+// With return_stats, stats_output holds the input, merged and kept box counts, the number of iou
+// tests and of those rejected by axis aligned boxes, and the nanoseconds spent sorting, merging and
+// suppressing, in this order. It is empty otherwise or if built with LANMS_DISABLE_INSTRUMENTATION.
 REGISTER_OP("LocalityAwareNMS")
-    .Input("vertices: float32")
+    .Input("vertices: T")
     .Input("probs: float32")
     .Input("iou_threshold: float32")
+    .Attr("T: {half, bfloat16, float, int16, int32} = DT_FLOAT")
+    .Attr("scale: float = 1.0")
+    .Attr("merge_window: int = 1")
+    .Attr("score_threshold: float = -inf")
+    .Attr("max_output_size: int = -1")
+    .Attr("return_indices: bool = false")
+    .Attr("return_stats: bool = false")
     .Output("vertices_output: float32")
     .Output("scores_output: float32")
+    .Output("indices_output: int32")
+    .Output("index_offsets_output: int32")
+    .Output("stats_output: int64")
     .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
       c->set_output(0, c->MakeShape({c->UnknownDim(), 4, 2}));
       c->set_output(1, c->MakeShape({c->UnknownDim()}));
+      c->set_output(2, c->MakeShape({c->UnknownDim()}));
+      c->set_output(3, c->MakeShape({c->UnknownDim()}));
+      c->set_output(4, c->MakeShape({c->UnknownDim()}));
       return Status::OK();
     });
 
 REGISTER_OP("StandardNMS")
-    .Input("vertices: float32")
+    .Input("vertices: T")
+    .Input("probs: float32")
+    .Input("iou_threshold: float32")
+    .Attr("T: {half, bfloat16, float, int16, int32} = DT_FLOAT")
+    .Attr("scale: float = 1.0")
+    .Attr("score_threshold: float = -inf")
+    .Attr("max_output_size: int = -1")
+    .Attr("return_indices: bool = false")
+    .Output("vertices_output: float32")
+    .Output("scores_output: float32")
+    .Output("indices_output: int32")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->MakeShape({c->UnknownDim(), 4, 2}));
+      c->set_output(1, c->MakeShape({c->UnknownDim()}));
+      c->set_output(2, c->MakeShape({c->UnknownDim()}));
+      return Status::OK();
+    });
+
+// Decays the scores of overlapping boxes instead of suppressing them, see nms::soft_nms. Boxes whose
+// score falls below score_threshold are dropped, the outputs hold the decayed scores.
+REGISTER_OP("SoftNMS")
+    .Input("vertices: T")
+    .Input("probs: float32")
+    .Input("iou_threshold: float32")
+    .Attr("T: {half, bfloat16, float, int16, int32} = DT_FLOAT")
+    .Attr("scale: float = 1.0")
+    .Attr("method: {'linear', 'gaussian'} = 'linear'")
+    .Attr("sigma: float = 0.5")
+    .Attr("score_threshold: float = 0.001")
+    .Attr("max_output_size: int = -1")
+    .Attr("return_indices: bool = false")
+    .Output("vertices_output: float32")
+    .Output("scores_output: float32")
+    .Output("indices_output: int32")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->MakeShape({c->UnknownDim(), 4, 2}));
+      c->set_output(1, c->MakeShape({c->UnknownDim()}));
+      c->set_output(2, c->MakeShape({c->UnknownDim()}));
+      return Status::OK();
+    });
+
+// Class aware variants of StandardNMS and LocalityAwareNMS: box i belongs to class class_ids[i] and
+// only boxes of the same class suppress or are merged with each other, classes are processed
+// concurrently. With class_agnostic all boxes are processed together, merged boxes take the class
+// of their highest scored box. Outputs of all classes are ordered by descending scores.
+REGISTER_OP("ClassAwareStandardNMS")
+    .Input("vertices: T")
+    .Input("probs: float32")
+    .Input("class_ids: int32")
+    .Input("iou_threshold: float32")
+    .Attr("T: {half, bfloat16, float, int16, int32} = DT_FLOAT")
+    .Attr("scale: float = 1.0")
+    .Attr("class_agnostic: bool = false")
+    .Attr("score_threshold: float = -inf")
+    .Attr("max_output_size: int = -1")
+    .Attr("return_indices: bool = false")
+    .Output("vertices_output: float32")
+    .Output("scores_output: float32")
+    .Output("class_ids_output: int32")
+    .Output("indices_output: int32")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->MakeShape({c->UnknownDim(), 4, 2}));
+      c->set_output(1, c->MakeShape({c->UnknownDim()}));
+      c->set_output(2, c->MakeShape({c->UnknownDim()}));
+      c->set_output(3, c->MakeShape({c->UnknownDim()}));
+      return Status::OK();
+    });
+
+REGISTER_OP("ClassAwareLocalityAwareNMS")
+    .Input("vertices: T")
     .Input("probs: float32")
+    .Input("class_ids: int32")
     .Input("iou_threshold: float32")
+    .Attr("T: {half, bfloat16, float, int16, int32} = DT_FLOAT")
+    .Attr("scale: float = 1.0")
+    .Attr("class_agnostic: bool = false")
+    .Attr("score_threshold: float = -inf")
+    .Attr("max_output_size: int = -1")
+    .Attr("return_indices: bool = false")
     .Output("vertices_output: float32")
     .Output("scores_output: float32")
+    .Output("class_ids_output: int32")
+    .Output("indices_output: int32")
+    .Output("index_offsets_output: int32")
     .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
       c->set_output(0, c->MakeShape({c->UnknownDim(), 4, 2}));
       c->set_output(1, c->MakeShape({c->UnknownDim()}));
+      c->set_output(2, c->MakeShape({c->UnknownDim()}));
+      c->set_output(3, c->MakeShape({c->UnknownDim()}));
+      c->set_output(4, c->MakeShape({c->UnknownDim()}));
       return Status::OK();
-    });
\ No newline at end of file
+    });
+
+// Locality aware NMS of the boxes of a tiled image: box i belongs to tile tile_ids[i] and its
+// vertices are relative to the top left corner tile_offsets[tile_ids[i]] of its tile, the outputs
+// are in image coordinates. Tiles are merged concurrently, only boxes within margin of a tile
+// border are suppressed across tiles, see nms::tiled_locality_aware_nms.
+REGISTER_OP("TiledLocalityAwareNMS")
+    .Input("vertices: T")
+    .Input("probs: float32")
+    .Input("tile_ids: int32")
+    .Input("tile_offsets: float32")
+    .Input("iou_threshold: float32")
+    .Attr("T: {half, bfloat16, float, int16, int32} = DT_FLOAT")
+    .Attr("scale: float = 1.0")
+    .Attr("tile_width: float")
+    .Attr("tile_height: float")
+    .Attr("margin: float")
+    .Attr("score_threshold: float = -inf")
+    .Attr("max_output_size: int = -1")
+    .Output("vertices_output: float32")
+    .Output("scores_output: float32")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->MakeShape({c->UnknownDim(), 4, 2}));
+      c->set_output(1, c->MakeShape({c->UnknownDim()}));
+      return Status::OK();
+    });
+
+// Decodes the bounding boxes of all pixels of EAST score and geometry maps, of shapes
+// (height, width) and (height, width, 5 or 8), scored at least score_threshold and merges them in
+// row major order.
+REGISTER_OP("GeometryMapLocalityAwareNMS")
+    .Input("score_map: float32")
+    .Input("geometry_map: float32")
+    .Input("iou_threshold: float32")
+    .Attr("score_threshold: float = 0.8")
+    .Attr("scale: float = 4.0")
+    .Attr("max_output_size: int = -1")
+    .Output("vertices_output: float32")
+    .Output("scores_output: float32")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->MakeShape({c->UnknownDim(), 4, 2}));
+      c->set_output(1, c->MakeShape({c->UnknownDim()}));
+      return Status::OK();
+    });
+
+static Status
+_batched_nms_shape_fn(::tensorflow::shape_inference::InferenceContext* c) {
+  auto batch_size = c->Dim(c->input(0), 0);
+  c->set_output(0, c->MakeShape({batch_size, c->UnknownDim(), 4, 2}));
+  c->set_output(1, c->MakeShape({batch_size, c->UnknownDim()}));
+  c->set_output(2, c->MakeShape({batch_size}));
+  return Status::OK();
+}
+
+// Batched variants of LocalityAwareNMS and StandardNMS, score_threshold and max_output_size apply to
+// each image on its own.
+REGISTER_OP("BatchedLocalityAwareNMS")
+    .Input("vertices: T")
+    .Input("probs: float32")
+    .Input("valid_counts: int32")
+    .Input("iou_threshold: float32")
+    .Attr("T: {half, bfloat16, float, int16, int32} = DT_FLOAT")
+    .Attr("scale: float = 1.0")
+    .Attr("score_threshold: float = -inf")
+    .Attr("max_output_size: int = -1")
+    .Output("vertices_output: float32")
+    .Output("scores_output: float32")
+    .Output("counts_output: int32")
+    .SetShapeFn(_batched_nms_shape_fn);
+
+REGISTER_OP("BatchedStandardNMS")
+    .Input("vertices: T")
+    .Input("probs: float32")
+    .Input("valid_counts: int32")
+    .Input("iou_threshold: float32")
+    .Attr("T: {half, bfloat16, float, int16, int32} = DT_FLOAT")
+    .Attr("scale: float = 1.0")
+    .Attr("score_threshold: float = -inf")
+    .Attr("max_output_size: int = -1")
+    .Output("vertices_output: float32")
+    .Output("scores_output: float32")
+    .Output("counts_output: int32")
+    .SetShapeFn(_batched_nms_shape_fn);
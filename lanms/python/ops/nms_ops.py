@@ -1,7 +1,196 @@
+import tensorflow as tf
 from tensorflow.python.framework import load_library
 from tensorflow.python.platform import resource_loader
 
 
 _nms_so_path = resource_loader.get_path_to_datafile("_nms_ops.so")
 _locality_aware_nms_ops = load_library.load_op_library(_nms_so_path)
-locality_aware_nms = _locality_aware_nms_ops.locality_aware_nms
+
+
+# Layout of the stats_output of the LocalityAwareNMS op.
+_STATS_NAMES = ("input_boxes", "merged_boxes", "kept_boxes", "iou_tests", "prefilter_rejects",
+                "sort_nanoseconds", "merge_nanoseconds", "suppress_nanoseconds")
+
+
+def _stats_dict(stats):
+    # The stats are empty if the op was built without instrumentation.
+    stats = tf.pad(stats, [[0, len(_STATS_NAMES) - tf.size(stats)]])
+    return {name: stats[i] for i, name in enumerate(_STATS_NAMES)}
+
+
+def locality_aware_nms(vertices, probs, iou_threshold, score_threshold=float("-inf"), max_output_size=-1,
+                       return_indices=False, merge_window=1, return_stats=False, scale=1.0):
+    """Locality aware nms.
+
+    vertices: Tensor of shape (num_boxes, 4, 2) of type float16, bfloat16, float32, int16 or int32.
+        Vertices are converted to float32 and multiplied by scale as they are read, e.g. to undo
+        the fixed point scale of integer vertices. All outputs are float32.
+    probs: Float32 tensor of shape (num_boxes, 1).
+    score_threshold: Boxes scored below this are dropped before merging.
+    max_output_size: At most this many boxes, those with the highest scores, are returned unless
+        negative.
+    merge_window: Number of merged boxes kept open while merging. Larger windows merge interleaved
+        text lines on the same rows, leaving fewer boxes for the quadratic standard nms step.
+
+    Returns vertices and scores of shapes (?, 4, 2) and (?,). If return_indices is set, the indices
+    of the input boxes merged into each output box are returned as well, as a flat tensor of
+    indices and a tensor of offsets of shape (? + 1,) such that the indices of output box i are
+    indices[offsets[i]:offsets[i + 1]], e.g. for use with tf.RaggedTensor.from_row_splits.
+
+    If return_stats is set, a dict of int64 scalars is returned last: the number of input, merged
+    and kept boxes, iou tests and of those rejected by axis aligned boxes, and the nanoseconds
+    spent per stage. All of them are zero if the op was built with LANMS_DISABLE_INSTRUMENTATION.
+    """
+    outputs = _locality_aware_nms_ops.locality_aware_nms(
+        vertices, probs, iou_threshold, score_threshold=score_threshold, max_output_size=max_output_size,
+        return_indices=return_indices, merge_window=merge_window, return_stats=return_stats, scale=scale)
+    results = [outputs[0], outputs[1]]
+    if return_indices:
+        results += [outputs[2], outputs[3]]
+    if return_stats:
+        results.append(_stats_dict(outputs[4]))
+    return tuple(results)
+
+
+def standard_nms(vertices, probs, iou_threshold, score_threshold=float("-inf"), max_output_size=-1,
+                 return_indices=False, scale=1.0):
+    """Standard nms, see locality_aware_nms.
+
+    If return_indices is set, the indices of the kept input boxes of shape (?,) are returned as
+    well, e.g. for use with tf.gather.
+    """
+    outputs = _locality_aware_nms_ops.standard_nms(
+        vertices, probs, iou_threshold, score_threshold=score_threshold, max_output_size=max_output_size,
+        return_indices=return_indices, scale=scale)
+    if return_indices:
+        return outputs[0], outputs[1], outputs[2]
+    return outputs[0], outputs[1]
+
+
+def class_aware_locality_aware_nms(vertices, probs, class_ids, iou_threshold, class_agnostic=False,
+                                   score_threshold=float("-inf"), max_output_size=-1, return_indices=False,
+                                   scale=1.0):
+    """Locality aware nms applied to each class separately in a single op call.
+
+    class_ids: Tensor of shape (num_boxes,) holding the class of each box. Only boxes of the same
+        class are merged and suppress each other unless class_agnostic is set, in which case all
+        boxes are processed together and each merged box takes the class of its highest scored box.
+
+    Returns vertices, scores and class ids of shapes (?, 4, 2), (?,) and (?,) ordered by descending
+    scores, and the indices and offsets of the contributing boxes if return_indices is set, see
+    locality_aware_nms.
+    """
+    outputs = _locality_aware_nms_ops.class_aware_locality_aware_nms(
+        vertices, probs, class_ids, iou_threshold, class_agnostic=class_agnostic, score_threshold=score_threshold,
+        max_output_size=max_output_size, return_indices=return_indices, scale=scale)
+    if return_indices:
+        return outputs[0], outputs[1], outputs[2], outputs[3], outputs[4]
+    return outputs[0], outputs[1], outputs[2]
+
+
+def class_aware_standard_nms(vertices, probs, class_ids, iou_threshold, class_agnostic=False,
+                             score_threshold=float("-inf"), max_output_size=-1, return_indices=False,
+                             scale=1.0):
+    """Standard nms applied to each class separately in a single op call, see
+    class_aware_locality_aware_nms.
+    """
+    outputs = _locality_aware_nms_ops.class_aware_standard_nms(
+        vertices, probs, class_ids, iou_threshold, class_agnostic=class_agnostic, score_threshold=score_threshold,
+        max_output_size=max_output_size, return_indices=return_indices, scale=scale)
+    if return_indices:
+        return outputs[0], outputs[1], outputs[2], outputs[3]
+    return outputs[0], outputs[1], outputs[2]
+
+
+def soft_nms(vertices, probs, iou_threshold, method="linear", sigma=0.5, score_threshold=0.001,
+             max_output_size=-1, return_indices=False, scale=1.0):
+    """Soft nms, see locality_aware_nms.
+
+    Instead of suppressing the boxes overlapping a kept box, their scores are decayed by 1 - iou if
+    iou >= iou_threshold (method "linear") or by exp(-iou^2 / sigma) (method "gaussian"). Boxes whose
+    score falls below score_threshold are dropped. Returns the kept boxes ordered by their decayed
+    scores, and their indices if return_indices is set.
+    """
+    outputs = _locality_aware_nms_ops.soft_nms(
+        vertices, probs, iou_threshold, method=method, sigma=sigma, score_threshold=score_threshold,
+        max_output_size=max_output_size, return_indices=return_indices, scale=scale)
+    if return_indices:
+        return outputs[0], outputs[1], outputs[2]
+    return outputs[0], outputs[1]
+
+
+def tiled_locality_aware_nms(vertices, probs, tile_ids, tile_offsets, tile_size, iou_threshold, margin,
+                             score_threshold=float("-inf"), max_output_size=-1, scale=1.0):
+    """Locality aware nms of the detections of an image processed in tiles.
+
+    vertices: Tensor of shape (num_boxes, 4, 2) relative to the top left corner of the tile of each
+        box, see locality_aware_nms for its types.
+    tile_ids: Int32 tensor of shape (num_boxes,), the tile of each box.
+    tile_offsets: Float32 tensor of shape (num_tiles, 2), the top left corner of each tile in the
+        image.
+    tile_size: Width and height of the tiles.
+    margin: Boxes further than this from the border of their tile must not overlap boxes of other
+        tiles, e.g. the overlap of adjacent tiles plus how far boxes may extend beyond their tile.
+
+    Each tile is merged on its own and the tiles concurrently, only boxes near tile borders are
+    suppressed across tiles. The result equals standard nms of the merged boxes of all tiles.
+    Returns vertices in image coordinates and scores of shapes (?, 4, 2) and (?,).
+    """
+    return _locality_aware_nms_ops.tiled_locality_aware_nms(
+        vertices, probs, tile_ids, tile_offsets, iou_threshold, tile_width=tile_size[0], tile_height=tile_size[1],
+        margin=margin, score_threshold=score_threshold, max_output_size=max_output_size, scale=scale)
+
+
+def geometry_map_locality_aware_nms(score_map, geometry_map, iou_threshold, score_threshold=0.8, scale=4.0,
+                                    max_output_size=-1):
+    """Locality aware nms applied directly to the outputs of EAST.
+
+    score_map: Tensor of shape (height, width).
+    geometry_map: Tensor of shape (height, width, 5) for RBOX geometry, i.e. the distances to the
+        top, right, bottom and left edges followed by the angle, or (height, width, 8) for QUAD
+        geometry, i.e. the offsets of the 4 vertices.
+    score_threshold: Only pixels scored at least this are decoded.
+    scale: Pixel (x, y) of the maps is located at (x * scale, y * scale) in the input image.
+
+    The boxes are decoded and merged in row major pixel order, as in EAST, without materializing or
+    sorting them. Returns vertices and scores of shapes (?, 4, 2) and (?,).
+    """
+    return _locality_aware_nms_ops.geometry_map_locality_aware_nms(
+        score_map, geometry_map, iou_threshold, score_threshold=score_threshold, scale=scale,
+        max_output_size=max_output_size)
+
+
+def _default_valid_counts(vertices, valid_counts):
+    if valid_counts is None:
+        shape = tf.shape(vertices)
+        valid_counts = tf.fill([shape[0]], shape[1])
+    return valid_counts
+
+
+def batched_locality_aware_nms(vertices, probs, iou_threshold, valid_counts=None, score_threshold=float("-inf"),
+                               max_output_size=-1, scale=1.0):
+    """Locality aware nms applied to each image of a batch.
+
+    vertices: Tensor of shape (batch_size, num_boxes, 4, 2), see locality_aware_nms for its types.
+    probs: Tensor of shape (batch_size, num_boxes).
+    valid_counts: Optional tensor of shape (batch_size,), only the first valid_counts[i] boxes of
+        image i are considered. Defaults to all boxes.
+    score_threshold, max_output_size: Applied to each image, see locality_aware_nms.
+
+    Returns vertices and scores zero padded to the largest number of output boxes in the batch,
+    i.e. of shapes (batch_size, ?, 4, 2) and (batch_size, ?), and the number of output boxes per
+    image of shape (batch_size,).
+    """
+    valid_counts = _default_valid_counts(vertices, valid_counts)
+    return _locality_aware_nms_ops.batched_locality_aware_nms(
+        vertices, probs, valid_counts, iou_threshold, score_threshold=score_threshold,
+        max_output_size=max_output_size, scale=scale)
+
+
+def batched_standard_nms(vertices, probs, iou_threshold, valid_counts=None, score_threshold=float("-inf"),
+                         max_output_size=-1, scale=1.0):
+    """Standard nms applied to each image of a batch, see batched_locality_aware_nms."""
+    valid_counts = _default_valid_counts(vertices, valid_counts)
+    return _locality_aware_nms_ops.batched_standard_nms(
+        vertices, probs, valid_counts, iou_threshold, score_threshold=score_threshold,
+        max_output_size=max_output_size, scale=scale)
@@ -2,7 +2,15 @@ import numpy as np
 import tensorflow as tf
 
 
+from lanms.python.ops.nms_ops import batched_locality_aware_nms
+from lanms.python.ops.nms_ops import batched_standard_nms
+from lanms.python.ops.nms_ops import class_aware_locality_aware_nms
+from lanms.python.ops.nms_ops import class_aware_standard_nms
+from lanms.python.ops.nms_ops import geometry_map_locality_aware_nms
 from lanms.python.ops.nms_ops import locality_aware_nms
+from lanms.python.ops.nms_ops import soft_nms
+from lanms.python.ops.nms_ops import standard_nms
+from lanms.python.ops.nms_ops import tiled_locality_aware_nms
 
 
 def test_two_nonrotated_rectangle_pairs():
@@ -169,3 +177,286 @@ def test_row_wise_sort_special_case():
 
     np.testing.assert_array_equal(vertices, expected_vertices)
     np.testing.assert_array_equal(scores, expected_scores)
+
+
+def test_batched_matches_per_image():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    box2 = box1 + [10, 0]
+    box3 = box1 + [0, 150]
+
+    # Second image only has two valid boxes, the third is padding.
+    vertices = np.array([
+        [box1, box2, box3],
+        [box3, box1, box2],
+    ], dtype=np.float32)
+    probs = np.array([
+        [0.9, 0.8, 0.7],
+        [0.6, 0.5, 0.0],
+    ], dtype=np.float32)
+    valid_counts = np.array([3, 2], dtype=np.int32)
+
+    batched_vertices, batched_scores, counts = batched_locality_aware_nms(
+        vertices, probs, iou_threshold=0.3, valid_counts=valid_counts)
+
+    np.testing.assert_array_equal(counts, [2, 2])
+    for i in range(2):
+        expected_vertices, expected_scores = locality_aware_nms(
+            vertices[i, :valid_counts[i]], probs[i, :valid_counts[i], np.newaxis], iou_threshold=0.3)
+        np.testing.assert_array_equal(batched_vertices[i, :counts[i]], expected_vertices)
+        np.testing.assert_array_equal(batched_scores[i, :counts[i]], expected_scores)
+
+
+def test_batched_standard_nms_matches_per_image():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    box2 = box1[::-1] + [10, 0]
+    box3 = box1[::-1] + [0, 150]
+
+    vertices = np.array([
+        [box1, box2, box3],
+        [box3, box2, box1],
+    ], dtype=np.float32)
+    probs = np.array([
+        [0.9, 0.8, 0.7],
+        [0.6, 0.5, 0.4],
+    ], dtype=np.float32)
+
+    batched_vertices, batched_scores, counts = batched_standard_nms(vertices, probs, iou_threshold=0.3)
+
+    np.testing.assert_array_equal(counts, [2, 2])
+    for i in range(2):
+        expected_vertices, expected_scores = standard_nms(vertices[i], probs[i, :, np.newaxis], iou_threshold=0.3)
+        np.testing.assert_array_equal(batched_vertices[i, :counts[i]], expected_vertices)
+        np.testing.assert_array_equal(batched_scores[i, :counts[i]], expected_scores)
+
+
+def test_counter_clockwise_vertices():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    vertices = np.array([box1, box1 + [0, 150]], dtype=np.float32)
+    probs = np.array([[0.9], [0.8]], dtype=np.float32)
+    # The same boxes reversed, starting from the same first vertex.
+    counter_clockwise_vertices = vertices[:, [0, 3, 2, 1]]
+
+    for nms in [locality_aware_nms, standard_nms]:
+        expected_vertices, expected_scores = nms(vertices, probs, iou_threshold=0.3)
+        output_vertices, scores = nms(counter_clockwise_vertices, probs, iou_threshold=0.3)
+        np.testing.assert_array_equal(output_vertices, expected_vertices)
+        np.testing.assert_array_equal(scores, expected_scores)
+
+    output_vertices, _ = soft_nms(counter_clockwise_vertices, probs, iou_threshold=0.3)
+    np.testing.assert_array_equal(output_vertices, vertices)
+
+    output_vertices, _, _ = batched_standard_nms(counter_clockwise_vertices[np.newaxis], probs[np.newaxis, :, 0],
+                                                 iou_threshold=0.3)
+    np.testing.assert_array_equal(output_vertices[0], vertices)
+
+
+def test_return_indices():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    box2 = box1 + [0, 150]
+    box3 = box1 + [10, 0]
+
+    vertices = tf.convert_to_tensor([box1, box2, box3], dtype=tf.float32)
+    probs = tf.convert_to_tensor([[0.5], [0.95], [0.25]], dtype=tf.float32)
+
+    # Box 1 and box 3 are merged into a single box.
+    _, scores, indices, offsets = locality_aware_nms(vertices, probs, iou_threshold=0.3, return_indices=True)
+    np.testing.assert_array_almost_equal(scores, [0.95, 0.75])
+    np.testing.assert_array_equal(indices, [1, 0, 2])
+    np.testing.assert_array_equal(offsets, [0, 1, 3])
+
+    # Box 3 is suppressed by box 1.
+    kept_vertices, _, indices = standard_nms(vertices, probs, iou_threshold=0.3, return_indices=True)
+    np.testing.assert_array_equal(indices, [1, 0])
+    np.testing.assert_array_equal(kept_vertices, tf.gather(vertices, indices))
+
+
+def test_return_stats():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    vertices = tf.convert_to_tensor([box1, box1 + [10, 0], box1 + [0, 150]], dtype=tf.float32)
+    probs = tf.convert_to_tensor([[0.5], [0.5], [0.1]], dtype=tf.float32)
+
+    _, scores, stats = locality_aware_nms(vertices, probs, iou_threshold=0.3, score_threshold=0.2,
+                                          return_stats=True)
+    np.testing.assert_array_almost_equal(scores, [1.0])
+    assert stats["input_boxes"] == 2
+    assert stats["merged_boxes"] == 1
+    assert stats["kept_boxes"] == 1
+    assert stats["merge_nanoseconds"] >= 0
+
+
+def test_input_types():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    vertices = np.array([box1, box1 + [10, 0], box1 + [0, 150]], dtype=np.float32)
+    probs = np.array([[0.5], [0.95], [0.25]], dtype=np.float32)
+    expected_vertices, expected_scores = locality_aware_nms(vertices, probs, iou_threshold=0.3)
+
+    # All vertices are exactly representable in each type, integer vertices are in 1/4 pixels.
+    for dtype, scale in [(tf.float16, 1.0), (tf.bfloat16, 1.0), (tf.int16, 0.25), (tf.int32, 0.25)]:
+        typed_vertices = tf.cast(vertices / scale, dtype)
+        merged_vertices, scores = locality_aware_nms(typed_vertices, probs, iou_threshold=0.3, scale=scale)
+        assert merged_vertices.dtype == tf.float32
+        np.testing.assert_array_almost_equal(merged_vertices, expected_vertices, decimal=4)
+        np.testing.assert_array_almost_equal(scores, expected_scores)
+
+        kept_vertices, _ = standard_nms(typed_vertices, probs, iou_threshold=0.3, scale=scale)
+        np.testing.assert_array_equal(kept_vertices, standard_nms(vertices, probs, iou_threshold=0.3)[0])
+
+
+def test_score_threshold_and_max_output_size():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    vertices = tf.convert_to_tensor([box1 + [0, 100 * i] for i in range(5)], dtype=tf.float32)
+    probs = tf.convert_to_tensor([[0.1], [0.9], [0.5], [0.7], [0.3]], dtype=tf.float32)
+
+    _, scores = locality_aware_nms(vertices, probs, iou_threshold=0.3, score_threshold=0.4)
+    np.testing.assert_array_almost_equal(scores, [0.9, 0.7, 0.5])
+
+    _, scores, indices = standard_nms(vertices, probs, iou_threshold=0.3, max_output_size=2, return_indices=True)
+    np.testing.assert_array_almost_equal(scores, [0.9, 0.7])
+    np.testing.assert_array_equal(indices, [1, 3])
+
+
+def test_batched_score_threshold_and_max_output_size():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    vertices = np.array([[box1 + [0, 100 * i] for i in range(5)]] * 2, dtype=np.float32)
+    probs = np.array([
+        [0.1, 0.9, 0.5, 0.7, 0.3],
+        [0.8, 0.2, 0.6, 0.1, 0.4],
+    ], dtype=np.float32)
+
+    for nms in [batched_locality_aware_nms, batched_standard_nms]:
+        _, scores, counts = nms(vertices, probs, iou_threshold=0.3, score_threshold=0.4)
+        np.testing.assert_array_equal(counts, [3, 3])
+        np.testing.assert_array_almost_equal(scores, [[0.9, 0.7, 0.5], [0.8, 0.6, 0.4]])
+
+        _, scores, counts = nms(vertices, probs, iou_threshold=0.3, max_output_size=2)
+        np.testing.assert_array_equal(counts, [2, 2])
+        np.testing.assert_array_almost_equal(scores, [[0.9, 0.7], [0.8, 0.6]])
+
+
+def test_soft_nms():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    box2 = box1 + [0, 150]
+    box3 = box1 + [10, 0]
+
+    vertices = tf.convert_to_tensor([box1, box2, box3], dtype=tf.float32)
+    probs = tf.convert_to_tensor([[0.5], [0.95], [0.25]], dtype=tf.float32)
+
+    # Box 3 overlaps box 1 with an iou of 9 / 11 and is decayed rather than suppressed.
+    _, scores, indices = soft_nms(vertices, probs, iou_threshold=0.3, return_indices=True)
+    np.testing.assert_array_almost_equal(scores, [0.95, 0.5, 0.25 * 2 / 11])
+    np.testing.assert_array_equal(indices, [1, 0, 2])
+
+    _, scores = soft_nms(vertices, probs, iou_threshold=0.3, method="gaussian")
+    np.testing.assert_array_almost_equal(scores, [0.95, 0.5, 0.25 * np.exp(-(9 / 11) ** 2 / 0.5)])
+
+    _, scores = soft_nms(vertices, probs, iou_threshold=0.3, score_threshold=0.1)
+    np.testing.assert_array_almost_equal(scores, [0.95, 0.5])
+
+
+def test_class_aware_nms():
+    box1 = np.array([
+        [50, 50],
+        [150, 50],
+        [150, 100],
+        [50, 100]
+    ])
+    box2 = box1 + [10, 0]
+
+    vertices = tf.convert_to_tensor([box1, box2], dtype=tf.float32)
+    probs = tf.convert_to_tensor([[0.5], [0.25]], dtype=tf.float32)
+    class_ids = tf.convert_to_tensor([2, 0], dtype=tf.int32)
+
+    # Boxes of different classes neither merge nor suppress each other.
+    _, scores, classes = class_aware_locality_aware_nms(vertices, probs, class_ids, iou_threshold=0.3)
+    np.testing.assert_array_almost_equal(scores, [0.5, 0.25])
+    np.testing.assert_array_equal(classes, [2, 0])
+
+    _, scores, classes, indices = class_aware_standard_nms(
+        vertices, probs, class_ids, iou_threshold=0.3, return_indices=True)
+    np.testing.assert_array_equal(indices, [0, 1])
+    np.testing.assert_array_equal(classes, [2, 0])
+
+    # Class agnostic merging takes the class of the highest scored box.
+    _, scores, classes = class_aware_locality_aware_nms(
+        vertices, probs, class_ids, iou_threshold=0.3, class_agnostic=True)
+    np.testing.assert_array_almost_equal(scores, [0.75])
+    np.testing.assert_array_equal(classes, [2])
+
+
+def test_tiled_locality_aware_nms():
+    # Two 200 x 100 tiles overlapping by 50 pixels, the box in the overlap is detected by both.
+    def box(x, y, w, h):
+        return [[x, y], [x + w, y], [x + w, y + h], [x, y + h]]
+
+    vertices = np.array([box(160, 40, 30, 20), box(20, 40, 40, 20), box(10, 40, 30, 20), box(100, 40, 40, 20)],
+                        dtype=np.float32)
+    probs = np.array([[0.9], [0.7], [0.8], [0.6]], dtype=np.float32)
+    tile_ids = np.array([0, 0, 1, 1], dtype=np.int32)
+    tile_offsets = np.array([[0, 0], [150, 0]], dtype=np.float32)
+
+    merged_vertices, scores = tiled_locality_aware_nms(vertices, probs, tile_ids, tile_offsets, tile_size=(200, 100),
+                                                       iou_threshold=0.3, margin=50)
+    np.testing.assert_array_almost_equal(scores, [0.9, 0.7, 0.6])
+    np.testing.assert_array_almost_equal(merged_vertices, [box(160, 40, 30, 20), box(20, 40, 40, 20),
+                                                           box(250, 40, 40, 20)])
+
+
+def test_geometry_map_rbox():
+    # A single text line covering 4 x 2 pixels of an 8 x 8 map, every pixel predicting the
+    # rectangle [8, 24] x [4, 12] in the input image.
+    score_map = np.zeros((8, 8), dtype=np.float32)
+    geometry_map = np.zeros((8, 8, 5), dtype=np.float32)
+    for y in range(1, 3):
+        for x in range(2, 6):
+            score_map[y, x] = 0.9
+            geometry_map[y, x, :4] = [4 * y - 4, 24 - 4 * x, 12 - 4 * y, 4 * x - 8]
+
+    vertices, scores = geometry_map_locality_aware_nms(score_map, geometry_map, iou_threshold=0.3)
+
+    np.testing.assert_array_almost_equal(vertices, [[[8, 4], [24, 4], [24, 12], [8, 12]]], decimal=4)
+    np.testing.assert_array_almost_equal(scores, [8 * 0.9])
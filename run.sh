@@ -16,6 +16,11 @@ case ${CMD} in
   test)
     DOCKER_CMD="bazel run lanms:nms_test"
     ;;
+  benchmark)
+    # Results are written to artifacts/, compare two of them with compare_benchmarks.py.
+    OUTPUT="${1:-benchmark.json}"
+    DOCKER_CMD="bazel run -c opt lanms:nms_benchmark -- --benchmark_out=/locality-aware-nms/artifacts/${OUTPUT} --benchmark_out_format=json"
+    ;;
   build)
     if [[ $# -lt 2 ]]; then  
       echo "Usage: $0 build PYTHON_VERSION TENSORFLOW_VERSION"